@@ -1,20 +1,33 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritev to write several at once.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * breadahead starts reading blocks that will be wanted soon.
+//     Its buffers are valid but still owned by the disk
+//     (b->disk) until the read finishes; bread waits for that.
+//
+// Buffers are hashed on (dev, blockno) into NBUCKET buckets,
+// each with its own lock, so lookups of different blocks
+// rarely contend. A bucket's lock protects the list through
+// prev/next and the refcnt of the buffers on it. Recycling a
+// buffer moves it from one bucket to another; bcache.lock
+// serializes recycling, so that only one process at a time
+// ever holds two bucket locks.
 
 
 #include "types.h"
+#include "stat.h"
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
@@ -23,69 +36,176 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 13
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;   // list of buffers hashed here, through prev/next.
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct spinlock lock; // serializes recycling of buffers.
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+struct iostat iostat;
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Unlink b from its bucket's list.
+// Caller holds that bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Add b to the front of bk's list.
+// Caller holds bk->lock.
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bk;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets; bget() moves them
+  // to the right bucket when it recycles them.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    blink(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
 }
 
+// Look for block blockno on device dev in bucket bk.
+// Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For readahead (prefetch set), return 0 instead if the block
+// is already cached or there is no free buffer, so that the
+// caller never waits for another process's buffer.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int prefetch)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  struct bucket *bk, *vbk, *obk;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(prefetch){
+      release(&bk->lock);
+      return 0;
     }
+    b->refcnt++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
+  // Recycle the least recently used unused buffer.
+  acquire(&bcache.lock);
+
+  // Another process may have cached the block while
+  // we didn't hold bk->lock.
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0){
+    if(prefetch){
+      release(&bk->lock);
       release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      return 0;
     }
+    b->refcnt++;
+    release(&bk->lock);
+    release(&bcache.lock);
+    acquiresleep(&b->lock);
+    return b;
   }
-  panic("bget: no buffers");
+
+  // Find the unused buffer with the oldest timestamp, keeping
+  // the lock of the bucket it is in (vbk) so that it stays unused.
+  // A buffer that readahead is still filling is not unused.
+  victim = 0;
+  vbk = 0;
+  for(obk = bcache.bucket; obk < bcache.bucket+NBUCKET; obk++){
+    if(obk != bk)
+      acquire(&obk->lock);
+    int found = 0;
+    for(b = obk->head.next; b != &obk->head; b = b->next){
+      if(b->refcnt == 0 && b->disk == 0 &&
+         (victim == 0 || b->timestamp < victim->timestamp)){
+        victim = b;
+        found = 1;
+      }
+    }
+    if(found){
+      if(vbk != 0 && vbk != bk)
+        release(&vbk->lock);
+      vbk = obk;
+    } else if(obk != bk){
+      release(&obk->lock);
+    }
+  }
+  if(victim == 0){
+    if(prefetch){
+      release(&bk->lock);
+      release(&bcache.lock);
+      return 0;
+    }
+    panic("bget: no buffers");
+  }
+
+  if(vbk != bk){
+    bunlink(victim);
+    release(&vbk->lock);
+    blink(bk, victim);
+  }
+  victim->dev = dev;
+  victim->blockno = blockno;
+  victim->valid = 0;
+  victim->refcnt = 1;
+  release(&bk->lock);
+  release(&bcache.lock);
+  acquiresleep(&victim->lock);
+  return victim;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,7 +214,11 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
+  if(b->disk) {
+    // breadahead's read is still in flight.
+    virtio_disk_wait(b);
+  }
   if(!b->valid) {
     virtio_disk_rw(b, 0);
     b->valid = 1;
@@ -102,6 +226,35 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the n blocks in blocks[] into the buffer cache,
+// and return without waiting for the disk. Blocks that are
+// already cached are skipped, as are those beyond the first
+// RABATCH, and all of them once there is no buffer to recycle.
+void
+breadahead(uint dev, uint *blocks, int n)
+{
+  struct buf *bs[RABATCH];
+  struct buf *b;
+  int i, k;
+
+  if(n > RABATCH)
+    n = RABATCH;
+  k = 0;
+  for(i = 0; i < n; i++){
+    if((b = bget(dev, blocks[i], 1)) == 0)
+      continue;
+    // valid as far as bread() is concerned; it waits
+    // for b->disk to clear before using the data.
+    b->valid = 1;
+    bs[k++] = b;
+  }
+  if(k == 0)
+    return;
+  virtio_disk_submit(bs, k, 0);
+  for(i = 0; i < k; i++)
+    brelse(bs[i]);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -111,43 +264,60 @@ bwrite(struct buf *b)
   virtio_disk_rw(b, 1);
 }
 
+// Write the contents of the n locked buffers in bs[] to disk,
+// as one batch of requests, and wait for all of them. Runs of
+// consecutive blocks in bs[] become single disk requests.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+  virtio_disk_submit(bs, n, 1);
+  for(i = 0; i < n; i++)
+    virtio_disk_wait(bs[i]);
+}
+
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Record when it was last used, for bget()'s recycling.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->timestamp = ticks;
   }
-  
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = bhash(b->dev, b->blockno);
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 
@@ -1,3 +1,7 @@
+// most blocks one breadahead() starts reading; its array of
+// them is on the kernel stack.
+#define RABATCH 16
+
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
@@ -5,8 +9,10 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint timestamp; // ticks when refcnt last dropped to zero
+  struct buf *prev; // hash bucket list
   struct buf *next;
+  struct buf *dnext; // next buf in the same disk request
   uchar data[BSIZE];
 };
 
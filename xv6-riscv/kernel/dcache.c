@@ -0,0 +1,182 @@
+// Directory entry cache.
+//
+// namex() consults the dcache before reading a directory, so a
+// repeated path walk locks no directory and reads no directory
+// blocks. An entry maps (dev, directory inum, name) to the inum
+// the name refers to, or to 0 if the directory has no such name
+// (a negative entry), so failed lookups are cached too.
+//
+// Entries are added only by a process that holds the directory's
+// inode lock and has just looked the name up. Every change to a
+// directory's entries updates the cache under that same lock:
+// sys_link() and create() enter the new name and sys_unlink()
+// removes the old one. A directory's entries are dropped when
+// its inode is freed, before its inum can be reused.
+//
+// dcache.lock protects everything here; it is taken before
+// itable.lock, since dclookup() calls iget().
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+#define NDCACHE 256
+#define NDHASH  61
+
+struct dentry {
+  uint dev;
+  uint dir;               // inum of the directory; 0 if unused
+  char name[DIRSIZ];
+  uint inum;              // 0 for a negative entry
+  struct dentry *hnext;   // hash chain
+  struct dentry *prev;    // LRU list, most recently used first
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry ent[NDCACHE];
+  struct dentry *hash[NDHASH];
+  struct dentry lru;      // head of the LRU list
+} dcache;
+
+static struct dentry**
+dchash(uint dev, uint dir, char *name)
+{
+  return &dcache.hash[(dev*31 + dir*17 + dirhash(name)) % NDHASH];
+}
+
+// Move d to the front of the LRU list, or to the back if it
+// is unused.
+static void
+dctouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  if(d->dir){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+  } else {
+    d->next = &dcache.lru;
+    d->prev = dcache.lru.prev;
+  }
+  d->next->prev = d;
+  d->prev->next = d;
+}
+
+static void
+dcunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = dchash(d->dev, d->dir, d->name); *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+  dctouch(d);
+}
+
+static struct dentry*
+dcfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = *dchash(dev, dir, name); d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.next = dcache.lru.prev = &dcache.lru;
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    d->next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+// Look up name in directory dp, which need not be locked.
+// On a hit, return 1 and set *ipp to the named inode, with
+// a reference, or to 0 if dp has no such name. Return 0 if
+// the cache does not know.
+int
+dclookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  dctouch(d);
+  // take the reference before anyone can unlink the name
+  // and free the inode.
+  *ipp = d->inum ? iget(d->dev, d->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in directory dp refers to inum, or to
+// nothing if inum is 0. Caller holds dp's lock.
+void
+dcenter(struct inode *dp, char *name, uint inum)
+{
+  struct dentry *d, **h;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) == 0){
+    d = dcache.lru.prev;
+    if(d->dir)
+      dcunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dchash(d->dev, d->dir, d->name);
+    d->hnext = *h;
+    *h = d;
+  }
+  d->inum = inum;
+  dctouch(d);
+  release(&dcache.lock);
+}
+
+// Forget name in directory dp. Caller holds dp's lock.
+void
+dcremove(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dcfind(dp->dev, dp->inum, name)) != 0)
+    dcunhash(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dir, whose inode is
+// being freed.
+void
+dcpurge(uint dev, uint dir)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.ent; d < dcache.ent+NDCACHE; d++)
+    if(d->dir == dir && d->dev == dev)
+      dcunhash(d);
+  release(&dcache.lock);
+}
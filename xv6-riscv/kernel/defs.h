@@ -2,6 +2,7 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iostat;
 struct pipe;
 struct proc;
 struct spinlock;
@@ -14,8 +15,11 @@ void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            breadahead(uint, uint*, int);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+extern struct iostat iostat;
 
 // console.c
 void            consoleinit(void);
@@ -24,6 +28,7 @@ void            consputc(int);
 
 // exec.c
 int             exec(char*, char**);
+int             loadpage(struct proc*, uint64, char*);
 
 // file.c
 struct file*    filealloc(void);
@@ -34,12 +39,20 @@ int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
 
+// dcache.c
+void            dcinit(void);
+int             dclookup(struct inode*, char*, struct inode**);
+void            dcenter(struct inode*, char*, uint);
+void            dcremove(struct inode*, char*);
+void            dcpurge(uint, uint);
+
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iget(uint, uint);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -52,6 +65,7 @@ struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
+int             writecost(uint);
 void            itrunc(struct inode*);
 
 // ramdisk.c
@@ -61,20 +75,30 @@ void            ramdiskrw(struct buf*);
 
 // kalloc.c
 void*           kalloc(void);
+void            kdup(void *);
 void            kfree(void *);
 void            kinit(void);
+int             krefcnt(void *);
+int             kfreepages(void);
+void*           ksuperalloc(void);
+void            ksuperdup(void *);
+void            ksuperfree(void *);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
-void            begin_op(void);
+void            begin_op(int);
 void            end_op(void);
+uint            log_seq(void);
+void            log_force(uint);
+int             log_maxop(void);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, uint64, int);
 int             pipewrite(struct pipe*, uint64, int);
+int             pipefcntl(struct pipe*, int, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -90,6 +114,7 @@ void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
+void            kthread(void(*)(void), char*);
 struct cpu*     mycpu(void);
 struct cpu*     getmycpu(void);
 struct proc*    myproc();
@@ -110,8 +135,11 @@ void            swtch(struct context*, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
+void            freelock(struct spinlock*);
 int             holding(struct spinlock*);
 void            initlock(struct spinlock*, char*);
+void            lockinit(void);
+void            lockstat(char*, uint64*, uint64*);
 void            release(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
@@ -146,6 +174,10 @@ void            trapinithart(void);
 extern struct spinlock tickslock;
 void            usertrapret(void);
 
+// usercopy.S
+int             ucopy(char *, char *, uint64);
+int             ucopystr(char *, char *, uint64);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
@@ -156,6 +188,10 @@ int             uartgetc(void);
 // vm.c
 void            kvminit(void);
 void            kvminithart(void);
+pagetable_t     kvmcreate(pagetable_t);
+void            kvmuser(pagetable_t, pagetable_t);
+void            kvmswitch(struct proc*);
+void            uvmflush(void);
 void            kvmmap(pagetable_t, uint64, uint64, uint64, int);
 int             mappages(pagetable_t, uint64, uint64, uint64, int);
 pagetable_t     uvmcreate(void);
@@ -163,14 +199,40 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+int             uvmdemote(pagetable_t, uint64);
+void            uvmsplit(pagetable_t, uint64, pagetable_t);
 void            uvmclear(pagetable_t, uint64);
+pte_t*          walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
+uint64          cowfault(pagetable_t, uint64);
+uint64          vmfault(pagetable_t, uint64, int);
+int             uvmprefault(uint64, uint64, int);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 
+// mmap.c
+void            mmapinit(void);
+uint64          mmap(uint64, uint64, int, int, struct file*, uint64);
+int             munmap(uint64, uint64);
+uint64          mmapfault(struct proc*, uint64, int);
+uint64          mmapbase(struct proc*);
+void            munmapall(struct proc*, pagetable_t);
+int             mmapfork(struct proc*, struct proc*);
+void            mmapwrite(struct inode*, uint, char*, uint);
+
+// swap.c
+void            swapinit(int, struct superblock*);
+int             swapout(void);
+uint64          swapin(pagetable_t, uint64);
+void            swapdup(uint64);
+void            swapfree(uint64);
+void*           kallocswap(void);
+void            swapreserve(int);
+
 // plic.c
 void            plicinit(void);
 void            plicinithart(void);
@@ -180,6 +242,8 @@ void            plic_complete(int);
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
+void            virtio_disk_submit(struct buf **, int, int);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
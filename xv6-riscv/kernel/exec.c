@@ -3,25 +3,37 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "sleeplock.h"
 #include "proc.h"
 #include "defs.h"
+#include "fs.h"
+#include "file.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+// exec() doesn't read the program into memory. It records the
+// program's loadable segments in the proc, and keeps a reference
+// to the executable's inode; vmfault() then calls loadpage() to
+// read each page of the program from the inode when the program
+// first touches it.
 
 int
 exec(char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, off, nseg;
   uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *oldexe;
   struct proghdr ph;
+  struct seg seg[NSEG];
   pagetable_t pagetable = 0, oldpagetable;
   struct proc *p = myproc();
 
-  begin_op();
+  // the new page tables and stack come from kalloc(), which
+  // doesn't swap.
+  swapreserve(8);
+
+  begin_op(MAXOPBLOCKS);
 
   if((ip = namei(path)) == 0){
     end_op();
@@ -38,7 +50,8 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program's segments.
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -48,18 +61,19 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz > USERTOP)
       goto bad;
-    sz = sz1;
     if((ph.vaddr % PGSIZE) != 0)
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(nseg >= NSEG)
       goto bad;
+    seg[nseg].va = ph.vaddr;
+    seg[nseg].off = ph.off;
+    seg[nseg].filesz = ph.filesz;
+    nseg++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
   }
-  iunlockput(ip);
-  end_op();
-  ip = 0;
 
   p = myproc();
   uint64 oldsz = p->sz;
@@ -68,6 +82,8 @@ exec(char *path, char **argv)
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
   uint64 sz1;
+  if(sz + 2*PGSIZE > USERTOP)
+    goto bad;
   if((sz1 = uvmalloc(pagetable, sz, sz + 2*PGSIZE)) == 0)
     goto bad;
   sz = sz1;
@@ -110,10 +126,25 @@ exec(char *path, char **argv)
     
   // Commit to the user image.
   oldpagetable = p->pagetable;
+  oldexe = p->exe;
   p->pagetable = pagetable;
+  kvmuser(p->kpagetable, pagetable);
   p->sz = sz;
+  p->exe = ip;
+  p->nseg = nseg;
+  memmove(p->seg, seg, sizeof(seg));
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
+
+  // keep the reference to ip for loadpage().
+  iunlock(ip);
+  if(oldexe)
+    iput(oldexe);
+  end_op();
+
+  // the old image's mapped files go with it. writing
+  // their dirty pages back needs transactions of its own.
+  munmapall(p, oldpagetable);
   proc_freepagetable(oldpagetable, oldsz);
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
@@ -128,27 +159,37 @@ exec(char *path, char **argv)
   return -1;
 }
 
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
+// Fill mem, a zeroed page, with the contents of p's program
+// image at page-aligned user virtual address va, read from
+// p's executable. Parts of the page that no segment's file
+// data covers stay zero.
 // Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
+int
+loadpage(struct proc *p, uint64 va, char *mem)
 {
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
+  struct seg *sg;
+  uint64 a, end;
+  uint n;
+  int r;
+
+  for(sg = p->seg; sg < &p->seg[p->nseg]; sg++){
+    // the part of this page that holds file data.
+    a = va > sg->va ? va : sg->va;
+    end = sg->va + sg->filesz;
+    if(end > va + PGSIZE)
+      end = va + PGSIZE;
+    if(a >= end)
+      continue;
+
+    // the process holds no inode or buffer locks: file
+    // reads and writes fault their buffers in first (see
+    // uvmprefault()), and only then lock the file.
+    ilock(p->exe);
+    n = end - a;
+    r = readi(p->exe, 0, (uint64)mem + (a - va), sg->off + (a - sg->va), n);
+    iunlock(p->exe);
+    if(r != n)
       return -1;
   }
-  
   return 0;
 }
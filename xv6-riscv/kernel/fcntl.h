@@ -3,3 +3,14 @@
 #define O_RDWR    0x002
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+// mmap() protections and flags
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+#define PROT_EXEC   0x4
+#define MAP_SHARED  0x1  // writes go back to the file
+#define MAP_PRIVATE 0x2  // writes stay in the process
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // get a pipe's buffer size limit
+#define F_SETPIPE_SZ 2  // set it
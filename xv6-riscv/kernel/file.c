@@ -13,6 +13,9 @@
 #include "stat.h"
 #include "proc.h"
 
+// the most bytes fileread() faults in and reads at a time.
+#define MAXREAD (8*PGSIZE)
+
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
@@ -76,7 +79,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
   } else if(ff.type == FD_INODE || ff.type == FD_DEVICE){
-    begin_op();
+    begin_op(MAXOPBLOCKS);
     iput(ff.ip);
     end_op();
   }
@@ -106,7 +109,7 @@ filestat(struct file *f, uint64 addr)
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  int r = 0, n1, m;
 
   if(f->readable == 0)
     return -1;
@@ -118,10 +121,26 @@ fileread(struct file *f, uint64 addr, int n)
       return -1;
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
-    ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
-    iunlock(f->ip);
+    // fault each chunk of the buffer in before readi() takes
+    // the inode's lock and buffer locks: see uvmprefault().
+    // a bad chunk after good ones ends the read short, since
+    // the good ones have been read and f->off moved past them.
+    while(r < n){
+      n1 = n - r;
+      if(n1 > MAXREAD)
+        n1 = MAXREAD;
+      if(uvmprefault(addr + r, n1, 1) < 0)
+        return r > 0 ? r : -1;
+      ilock(f->ip);
+      if((m = readi(f->ip, 1, addr + r, f->off, n1)) > 0)
+        f->off += m;
+      iunlock(f->ip);
+      if(m < 0)
+        return r > 0 ? r : -1;
+      r += m;
+      if(m < n1)
+        break;
+    }
   } else {
     panic("fileread");
   }
@@ -146,20 +165,23 @@ filewrite(struct file *f, uint64 addr, int n)
       return -1;
     ret = devsw[f->major].write(1, addr, n);
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    // write as many blocks at a time as one FS op may
+    // log, reserving what each chunk may need: see
+    // writecost(). this really belongs lower down, since
+    // writei() might be writing a device like the console.
+    int max = BSIZE * log_maxop();
+    while(max > BSIZE && writecost(max) > log_maxop())
+      max -= BSIZE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      // see uvmprefault().
+      if(uvmprefault(addr + i, n1, 0) < 0)
+        break;
+      begin_op(writecost(n1));
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -18,15 +18,26 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // itable hash chain
+  struct inode *lnext; // itable LRU list, while ref is 0
+  struct inode *lprev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ranext;        // block after the last one readi() read
+  uint raend;         // block after the last one read ahead
+  uint rawin;         // readahead window, in blocks
+  uint extbn;         // bmap()'s last run of consecutive blocks:
+  uint extaddr;       //   file blocks extbn..extbn+extlen-1 are
+  uint extlen;        //   disk blocks extaddr..extaddr+extlen-1
+  uint tseq;          // log transaction that last changed the inode
+  int nmpage;         // pages mapped shared (see mmap.c)
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // map major device number to device functions.
@@ -11,6 +11,7 @@
 
 #include "types.h"
 #include "riscv.h"
+#include "memlayout.h"
 #include "defs.h"
 #include "param.h"
 #include "stat.h"
@@ -26,6 +27,8 @@
 // only one device
 struct superblock sb; 
 
+static void bsuminit(int);
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -44,6 +47,8 @@ fsinit(int dev) {
   if(sb.magic != FSMAGIC)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
+  swapinit(dev, &sb);
 }
 
 // Zero a block.
@@ -59,28 +64,125 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// The bitmap is divided into groups of BPB blocks, one bitmap
+// block each, and bsum counts each group's free blocks, so
+// that balloc() reads only bitmap blocks with a free block in
+// them. A group's count changes only while its bitmap block is
+// locked, so that lock protects it too; balloc() reads it
+// without one as a hint.
+//
+// balloc() is given a goal, normally the block after the one
+// before the new block in its file, and takes the goal if it
+// is free. Otherwise it starts a new run at the next wholly
+// free, aligned run of BRUN blocks, so that files written at
+// the same time do not interleave block by block, and only
+// then takes any free block. With no goal it carries on from
+// the last block it allocated.
+
+#define NGROUP (FSSIZE/BPB + 1)
+#define BRUN   16
+
+static struct {
+  int ngroup;
+  int nfree[NGROUP];
+  uint rotor;           // block after the last one allocated
+} bsum;
+
+// Count the free blocks in each group.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int g, bi;
+
+  bsum.ngroup = (sb.size + BPB - 1) / BPB;
+  if(bsum.ngroup > NGROUP)
+    panic("bsuminit: file system too big");
+  for(g = 0; g < bsum.ngroup; g++){
+    bp = bread(dev, BBLOCK(g*BPB, sb));
+    bsum.nfree[g] = 0;
+    for(bi = 0; bi < BPB && g*BPB + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[g]++;
+    brelse(bp);
+  }
+  bsum.rotor = sb.bmapstart + bsum.ngroup;
+}
+
+// Is bit bi of map clear, and, if run is set, are all the bits
+// of the BRUN-aligned run it starts?
+static int
+bisfree(uchar *map, int bi, int run)
+{
+  int i;
+
+  if(run){
+    for(i = 0; i < BRUN/8; i++)
+      if(map[bi/8 + i] != 0)
+        return 0;
+    return 1;
+  }
+  return (map[bi/8] & (1 << (bi % 8))) == 0;
+}
+
+// Find a free block, or a free run if run is set, among
+// the first n bits of map from bit start on.
+static int
+bscan(uchar *map, int start, int n, int run)
+{
+  int bi;
+
+  if(run){
+    for(bi = (start + BRUN - 1) / BRUN * BRUN; bi + BRUN <= n; bi += BRUN)
+      if(bisfree(map, bi, 1))
+        return bi;
+    return -1;
+  }
+  for(bi = start; bi < n; bi++){
+    if(bi % 8 == 0 && map[bi/8] == 0xff){
+      bi += 7;
+      continue;
+    }
+    if(bisfree(map, bi, 0))
+      return bi;
+  }
+  return -1;
+}
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, near goal if possible.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int g, i, bi, n, run;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.rotor;
+  for(run = 1; run >= 0; run--){
+    // look from goal to the end of the disk, and
+    // then from the start of the disk to goal.
+    for(i = 0; i <= bsum.ngroup; i++){
+      g = (goal/BPB + i) % bsum.ngroup;
+      if(bsum.nfree[g] == 0)
+        continue;
+      bp = bread(dev, BBLOCK(g*BPB, sb));
+      n = min(BPB, sb.size - g*BPB);
+      if(i == 0 && run && bisfree(bp->data, goal % BPB, 0))
+        bi = goal % BPB;
+      else
+        bi = bscan(bp->data, i == 0 ? goal % BPB : 0, n, run);
+      if(bi >= 0){
+        bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
         log_write(bp);
+        bsum.nfree[g]--;
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        bsum.rotor = g*BPB + bi + 1;
+        bzero(dev, g*BPB + bi);
+        return g*BPB + bi;
       }
+      brelse(bp);
     }
-    brelse(bp);
   }
   panic("balloc: out of blocks");
 }
@@ -99,6 +201,7 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  bsum.nfree[b / BPB]++;
   brelse(bp);
 }
 
@@ -165,30 +268,88 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while using any of those fields,
+// or ip->hnext, ip->lnext and ip->lprev.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
+//
+// The table is sized at boot, with an entry for every INODEMEM
+// bytes of memory but no fewer than NINODE, and its entries
+// are hashed on (dev, inum). An entry whose ref drops to zero
+// keeps its contents and its place in the hash table, on an
+// LRU list, until iget() recycles it for another inode; until
+// then, iget() of the same inode finds it there and ilock()
+// need not read it from disk again.
+
+#define INODEMEM (16*PGSIZE)
+#define NIHASH   509
+
+extern char end[]; // first address after kernel.
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  int n;                        // number of entries
+  struct inode *hash[NIHASH];   // entries in use, through hnext
+  struct inode lru;             // entries with ref 0, most recently used first
 } itable;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &itable.hash[(dev*31 + inum) % NIHASH];
+}
+
+// Take ip off the LRU list.
+static void
+lruremove(struct inode *ip)
+{
+  ip->lnext->lprev = ip->lprev;
+  ip->lprev->lnext = ip->lnext;
+}
+
+// Put ip on the LRU list: at the front, or at the back
+// if its contents are not worth keeping.
+static void
+lruadd(struct inode *ip)
+{
+  if(ip->valid){
+    ip->lnext = itable.lru.lnext;
+    ip->lprev = &itable.lru;
+  } else {
+    ip->lnext = &itable.lru;
+    ip->lprev = itable.lru.lprev;
+  }
+  ip->lnext->lprev = ip;
+  ip->lprev->lnext = ip;
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
+  struct inode *ip = 0;
+  int i, per;
+
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  itable.lru.lnext = itable.lru.lprev = &itable.lru;
+
+  itable.n = (PHYSTOP - PGROUNDUP((uint64)end)) / INODEMEM;
+  if(itable.n < NINODE)
+    itable.n = NINODE;
+  per = PGSIZE / sizeof(struct inode);
+  for(i = 0; i < itable.n; i++){
+    if(i % per == 0){
+      if((ip = kalloc()) == 0)
+        panic("iinit");
+      memset(ip, 0, PGSIZE);
+    }
+    initsleeplock(&ip->lock, "inode");
+    lruadd(ip);
+    ip++;
   }
 }
 
-static struct inode* iget(uint dev, uint inum);
-
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
@@ -226,6 +387,7 @@ iupdate(struct inode *ip)
 
   bp = bread(ip->dev, IBLOCK(ip->inum, sb));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
+  ip->tseq = log_seq();
   dip->type = ip->type;
   dip->major = ip->major;
   dip->minor = ip->minor;
@@ -239,34 +401,44 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
-static struct inode*
+struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = *ihash(dev, inum); ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Recycle the least recently used entry.
+  ip = itable.lru.lprev;
+  if(ip == &itable.lru)
     panic("iget: no inodes");
+  lruremove(ip);
+  if(ip->inum != 0){
+    for(pp = ihash(ip->dev, ip->inum); *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
 
-  ip = empty;
+  pp = ihash(dev, inum);
+  ip->hnext = *pp;
+  *pp = ip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->ranext = 0;
+  ip->raend = 0;
+  ip->rawin = 0;
   release(&itable.lock);
 
   return ip;
@@ -305,6 +477,10 @@ ilock(struct inode *ip)
     ip->nlink = dip->nlink;
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
+    ip->extlen = 0;
+    // the inode may have left the table before the change
+    // that made it what it is was committed.
+    ip->tseq = log_seq();
     brelse(bp);
     ip->valid = 1;
     if(ip->type == 0)
@@ -343,6 +519,8 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcpurge(ip->dev, ip->inum);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
@@ -353,7 +531,8 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruadd(ip);
   release(&itable.lock);
 }
 
@@ -370,38 +549,120 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], and the NDINDIRECT
+// after those in the blocks listed in block ip->addrs[NDIRECT+1].
+//
+// An in-memory inode remembers the run of consecutive disk
+// blocks that bmap() last found, so that mapping a file laid
+// out contiguously reads each indirect block once per run
+// rather than once per data block.
+
+// Remember that the entries of a[] from i on, for file blocks
+// from bn on, are a run of consecutive disk blocks, up to
+// entry n-1.
+static void
+setext(struct inode *ip, uint bn, uint *a, uint i, uint n)
+{
+  uint j;
+
+  for(j = i + 1; j < n && a[j] == a[i] + (j - i); j++)
+    ;
+  ip->extbn = bn;
+  ip->extaddr = a[i];
+  ip->extlen = j - i;
+}
+
+// Return entry i of indirect block addr, allocating a block
+// for it if there is none, after entry i-1's block or else
+// near goal. If setx, remember the run that starts there, as
+// file block bn.
+static uint
+indirect(struct inode *ip, uint addr, uint i, uint bn, uint goal, int setx)
+{
+  struct buf *bp;
+  uint *a;
+
+  bp = bread(ip->dev, addr);
+  __sync_fetch_and_add(&iostat.mapreads, 1);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    if(i > 0 && a[i-1])
+      goal = a[i-1] + 1;
+    a[i] = addr = balloc(ip->dev, goal);
+    log_write(bp);
+  }
+  if(setx)
+    setext(ip, bn, a, i, NINDIRECT);
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, n, goal;
+
+  if(bn - ip->extbn < ip->extlen)
+    return ip->extaddr + (bn - ip->extbn);
+
+  // a new block should follow the file's previous one,
+  // when the extent says where that is.
+  goal = 0;
+  if(ip->extlen && bn == ip->extbn + ip->extlen)
+    goal = ip->extaddr + ip->extlen;
 
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0){
+      if(bn > 0 && ip->addrs[bn-1])
+        goal = ip->addrs[bn-1] + 1;
+      ip->addrs[bn] = addr = balloc(ip->dev, goal);
+    }
+    setext(ip, bn, ip->addrs, bn, NDIRECT);
     return addr;
   }
-  bn -= NDIRECT;
+  n = bn - NDIRECT;
+  if(goal == 0 && ip->addrs[NDIRECT-1])
+    goal = ip->addrs[NDIRECT-1] + 1;
 
-  if(bn < NINDIRECT){
+  if(n < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, goal);
+    return indirect(ip, addr, n, bn, goal, 1);
+  }
+  n -= NINDIRECT;
+
+  if(n < NDINDIRECT){
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = balloc(ip->dev, goal);
+    addr = indirect(ip, addr, n / NINDIRECT, bn, goal, 0);
+    return indirect(ip, addr, n % NINDIRECT, bn, goal, 1);
+  }
+
+  panic("bmap: out of range");
+}
+
+// Free block addr and, if it is an indirect block of the
+// given depth, the blocks it lists.
+static void
+bfreetree(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  if(depth > 0){
+    bp = bread(dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        bfreetree(dev, a[j], depth - 1);
     }
     brelse(bp);
-    return addr;
   }
-
-  panic("bmap: out of range");
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -409,28 +670,15 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
-  for(i = 0; i < NDIRECT; i++){
+  for(i = 0; i < NDIRECT+2; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      bfreetree(ip->dev, ip->addrs[i], i < NDIRECT ? 0 : i - NDIRECT + 1);
       ip->addrs[i] = 0;
     }
   }
-
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
-  }
+  ip->extlen = 0;
 
   ip->size = 0;
   iupdate(ip);
@@ -448,6 +696,50 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Readahead window limits, in blocks.
+#define RAMIN 4
+#define RAMAX RABATCH
+
+// Sequential readahead for a read of blocks first..last of ip.
+// A read that starts where the previous one stopped (or in its
+// last block) continues a sequential run; readahead() then
+// keeps the next rawin blocks in flight, starting the reads
+// for the current blocks too so that they go to the disk as
+// one batch. The window doubles, up to RAMAX, each time it has
+// to be refilled, and a non-sequential read closes it.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint blocks[RAMAX];
+  uint bn, end, nblk;
+  int n;
+
+  if(first != ip->ranext && first + 1 != ip->ranext){
+    ip->ranext = last + 1;
+    ip->raend = last + 1;
+    ip->rawin = 0;
+    return;
+  }
+  ip->ranext = last + 1;
+
+  // refill once less than half the window is left.
+  if(ip->raend > last + ip->rawin / 2)
+    return;
+  if(ip->rawin == 0)
+    ip->rawin = RAMIN;
+  else if(ip->rawin < RAMAX)
+    ip->rawin *= 2;
+
+  nblk = (ip->size + BSIZE - 1) / BSIZE;
+  bn = ip->raend > first ? ip->raend : first;
+  end = min(last + 1 + ip->rawin, nblk);
+  for(n = 0; bn < end && n < RAMAX; bn++)
+    blocks[n++] = bmap(ip, bn);
+  ip->raend = bn;
+  breadahead(ip->dev, blocks, n);
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -462,6 +754,8 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     return 0;
   if(off + n > ip->size)
     n = ip->size - off;
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
@@ -502,6 +796,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       break;
     }
     log_write(bp);
+    if(ip->nmpage)
+      mmapwrite(ip, off, (char*)bp->data + (off % BSIZE), m);
     brelse(bp);
   }
 
@@ -516,6 +812,23 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// The most blocks a writei() of n bytes may log: the data
+// blocks it touches, the indirect blocks that map them, the
+// bitmap blocks that allocate both, and the i-node.
+int
+writecost(uint n)
+{
+  int nb, nind, nbmap;
+
+  // an unaligned write touches part of a block at each end.
+  nb = n/BSIZE + 2;
+  // the singly- and doubly-indirect blocks, and the blocks
+  // the latter points to that map the range.
+  nind = 2 + nb/NINDIRECT + 2;
+  nbmap = min(nb + nind, sb.size/BPB + 1);
+  return nb + nind + nbmap + 1;
+}
+
 // Directories
 
 int
@@ -524,17 +837,285 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories; see struct dxhead in fs.h.
+
+// If dp is hashed, return its locked block 0, else 0.
+// A hashed directory has at least two blocks.
+static struct buf*
+dxroot(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxhead *hd;
+
+  if(dp->size < 2*BSIZE)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  hd = (struct dxhead*)(bp->data + 2*sizeof(struct dirent));
+  if(hd->zero == 0 && hd->zero2 == 0 && hd->magic == DXMAGIC)
+    return bp;
+  brelse(bp);
+  return 0;
+}
+
+// Return the leaf block for hash h, given root block bp,
+// and set *pi to the index of its dxent.
+static uint
+dxfind(struct buf *bp, uint h, int *pi)
+{
+  struct dxhead *hd = (struct dxhead*)(bp->data + 2*sizeof(struct dirent));
+  struct dxent *e = (struct dxent*)(hd + 1);
+  int i;
+
+  for(i = 1; i < hd->n && e[i].hash <= h; i++)
+    ;
+  *pi = i - 1;
+  return e[i-1].block;
+}
+
+// Is block bn of the directory a leaf, named by a dxent in
+// root block bp, rather than an overflow block?
+static int
+dxisleaf(struct buf *bp, uint bn)
+{
+  struct dxhead *hd = (struct dxhead*)(bp->data + 2*sizeof(struct dirent));
+  struct dxent *e = (struct dxent*)(hd + 1);
+  int i;
+
+  for(i = 0; i < hd->n; i++)
+    if(e[i].block == bn)
+      return 1;
+  return 0;
+}
+
+// Look for name in the leaf block bn of directory dp.
+static struct inode*
+dxscan(struct inode *dp, uint bn, char *name, uint *poff)
+{
+  struct buf *bp;
+  struct dirent *de;
+  uint inum;
+  int i;
+
+  bp = bread(dp->dev, bmap(dp, bn));
+  de = (struct dirent*)bp->data;
+  for(i = 0; i < DPB; i++){
+    if(de[i].inum != 0 && namecmp(name, de[i].name) == 0){
+      if(poff)
+        *poff = bn*BSIZE + i*sizeof(struct dirent);
+      inum = de[i].inum;
+      brelse(bp);
+      return iget(dp->dev, inum);
+    }
+  }
+  brelse(bp);
+  return 0;
+}
+
+// Turn dp, a full one-block directory that starts with "."
+// and "..", into a hashed directory with a single leaf.
+static int
+dxconvert(struct inode *dp)
+{
+  struct buf *bp, *lp;
+  struct dirent *de;
+  struct dxhead *hd;
+  struct dxent *e;
+
+  bp = bread(dp->dev, bmap(dp, 0));
+  de = (struct dirent*)bp->data;
+  if(namecmp(de[0].name, ".") != 0 || namecmp(de[1].name, "..") != 0){
+    brelse(bp);
+    return -1;
+  }
+  lp = bread(dp->dev, bmap(dp, 1));
+  memmove(lp->data, &de[2], BSIZE - 2*sizeof(struct dirent));
+  log_write(lp);
+  brelse(lp);
+
+  memset(&de[2], 0, BSIZE - 2*sizeof(struct dirent));
+  hd = (struct dxhead*)&de[2];
+  hd->magic = DXMAGIC;
+  hd->n = 1;
+  e = (struct dxent*)(hd + 1);
+  e[0].hash = 0;
+  e[0].block = 1;
+  log_write(bp);
+  brelse(bp);
+
+  dp->size = 2*BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
+// Split the full leaf lp, the i'th in root block bp, moving
+// the entries whose names hash at or above a median hash to
+// a new leaf at the end of the directory.
+static int
+dxsplit(struct inode *dp, struct buf *bp, int i, struct buf *lp)
+{
+  struct dxhead *hd = (struct dxhead*)(bp->data + 2*sizeof(struct dirent));
+  struct dxent *e = (struct dxent*)(hd + 1);
+  struct dirent *de = (struct dirent*)lp->data;
+  struct dirent *nde;
+  struct buf *np;
+  uint hs[DPB], h, m, nb;
+  int j, k, n;
+
+  nb = dp->size / BSIZE;
+  if(hd->n >= DXMAX || nb >= MAXFILE)
+    return -1;
+
+  // sort the leaf's hashes, and split where they change
+  // nearest the middle, so equal hashes share a leaf.
+  for(j = 0; j < DPB; j++){
+    h = dirhash(de[j].name);
+    for(k = j; k > 0 && hs[k-1] > h; k--)
+      hs[k] = hs[k-1];
+    hs[k] = h;
+  }
+  for(k = DPB/2; k < DPB && hs[k] == hs[k-1]; k++)
+    ;
+  if(k == DPB)
+    for(k = DPB/2; k > 0 && hs[k] == hs[k-1]; k--)
+      ;
+  if(k == 0)
+    return -1;
+  m = hs[k];
+
+  np = bread(dp->dev, bmap(dp, nb));
+  nde = (struct dirent*)np->data;
+  n = 0;
+  for(j = 0; j < DPB; j++){
+    if(dirhash(de[j].name) >= m){
+      nde[n++] = de[j];
+      memset(&de[j], 0, sizeof(de[j]));
+    }
+  }
+  log_write(np);
+  brelse(np);
+  log_write(lp);
+
+  memmove(&e[i+2], &e[i+1], (hd->n - i - 1) * sizeof(*e));
+  memset(&e[i+1], 0, sizeof(*e));
+  e[i+1].hash = m;
+  e[i+1].block = nb;
+  hd->n++;
+  log_write(bp);
+
+  dp->size += BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
+// Add (name, inum) to a free entry of an overflow block of
+// hashed directory dp, whose block 0 is bp, or to a new
+// overflow block at the end. Releases bp.
+static int
+dxoverflow(struct inode *dp, struct buf *bp, char *name, uint inum)
+{
+  struct buf *lp;
+  struct dirent *de;
+  uint bn, nb;
+  int j;
+
+  nb = dp->size / BSIZE;
+  for(bn = 1; bn <= nb; bn++){
+    if(bn < nb && dxisleaf(bp, bn))
+      continue;
+    if(bn == nb && nb >= MAXFILE)
+      break;
+    lp = bread(dp->dev, bmap(dp, bn));
+    de = (struct dirent*)lp->data;
+    for(j = 0; j < DPB; j++){
+      if(de[j].inum == 0){
+        strncpy(de[j].name, name, DIRSIZ);
+        de[j].inum = inum;
+        log_write(lp);
+        brelse(lp);
+        brelse(bp);
+        if(bn == nb){
+          dp->size += BSIZE;
+          iupdate(dp);
+        }
+        return 0;
+      }
+    }
+    brelse(lp);
+  }
+  brelse(bp);
+  return -1;
+}
+
+// Add (name, inum) to hashed directory dp, whose block 0 is bp.
+// Releases bp.
+static int
+dxlink(struct inode *dp, struct buf *bp, char *name, uint inum)
+{
+  struct buf *lp;
+  struct dirent *de;
+  uint h = dirhash(name);
+  int i, j;
+
+  for(;;){
+    lp = bread(dp->dev, bmap(dp, dxfind(bp, h, &i)));
+    de = (struct dirent*)lp->data;
+    for(j = 0; j < DPB; j++){
+      if(de[j].inum == 0){
+        strncpy(de[j].name, name, DIRSIZ);
+        de[j].inum = inum;
+        log_write(lp);
+        brelse(lp);
+        brelse(bp);
+        return 0;
+      }
+    }
+    // both halves of a split have room, so this
+    // loops at most twice.
+    if(dxsplit(dp, bp, i, lp) < 0){
+      brelse(lp);
+      return dxoverflow(dp, bp, name, inum);
+    }
+    brelse(lp);
+  }
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint off, inum, bn, nb;
   struct dirent de;
+  struct inode *ip;
+  struct buf *bp;
+  int i;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if((bp = dxroot(dp)) != 0){
+    // "." and ".." stay at the start of block 0.
+    if(namecmp(name, ".") == 0 || namecmp(name, "..") == 0){
+      brelse(bp);
+      return dxscan(dp, 0, name, poff);
+    }
+    off = dxfind(bp, dirhash(name), &i);
+    if((ip = dxscan(dp, off, name, poff)) != 0){
+      brelse(bp);
+      return ip;
+    }
+    // then the overflow blocks, if there are any.
+    nb = dp->size / BSIZE;
+    ip = 0;
+    if(nb - 1 > ((struct dxhead*)(bp->data + 2*sizeof(struct dirent)))->n){
+      for(bn = 1; bn < nb && ip == 0; bn++)
+        if(!dxisleaf(bp, bn))
+          ip = dxscan(dp, bn, name, poff);
+    }
+    brelse(bp);
+    return ip;
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -559,6 +1140,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   int off;
   struct dirent de;
   struct inode *ip;
+  struct buf *bp;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -566,6 +1148,12 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  // for fsync(); dxlink() need not call iupdate().
+  dp->tseq = log_seq();
+
+  if((bp = dxroot(dp)) != 0)
+    return dxlink(dp, bp, name, inum);
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -574,6 +1162,11 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  // A full one-block directory becomes hashed
+  // rather than grow.
+  if(off == BSIZE && dp->size == BSIZE && dxconvert(dp) == 0)
+    return dxlink(dp, dxroot(dp), name, inum);
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -636,6 +1229,15 @@ namex(char *path, int nameiparent, char *name)
     ip = idup(myproc()->cwd);
 
   while((path = skipelem(path, name)) != 0){
+    // only directories have dcache entries, so a hit
+    // needs no look at ip itself.
+    if((!nameiparent || *path != '\0') && dclookup(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = next;
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -646,7 +1248,9 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
+    next = dirlookup(ip, name, 0);
+    dcenter(ip, name, next ? next->inum : 0);
+    if(next == 0){
       iunlockput(ip);
       return 0;
     }
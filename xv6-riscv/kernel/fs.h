@@ -8,6 +8,7 @@
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
 //                                          free bit map | data blocks]
+// followed by the swap area, which is not part of the file system.
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +21,16 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of swap blocks
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +39,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -58,3 +62,49 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Dirents per block.
+#define DPB (BSIZE / sizeof(struct dirent))
+
+// A directory that outgrows one block becomes hashed. Its
+// block 0 then holds ".", "..", a dxhead, and an index of
+// dxents sorted by hash, each naming the block that holds the
+// entries whose names hash at least as high as its hash and
+// lower than the next dxent's. Those leaf blocks are plain
+// dirents. Once the index is full, or a leaf can't be split,
+// entries that don't fit in their leaf go in overflow blocks,
+// the blocks no dxent names, which a lookup that misses in the
+// leaf searches in turn, as in a linear directory, so the
+// directory can still grow to MAXFILE blocks. dxhead and
+// dxent are the size of a dirent and
+// start with a zero inum, so code that reads a directory as
+// an array of dirents sees them as free entries.
+struct dxhead {
+  ushort zero;       // 0, like a free dirent's inum
+  uchar zero2;       // 0, where a dirent's name starts
+  uchar magic;       // DXMAGIC
+  uint n;            // number of dxents
+  uint pad[2];
+};
+
+struct dxent {
+  ushort zero;       // 0, like a free dirent's inum
+  ushort pad;
+  uint hash;         // least hash of the names in block
+  uint block;        // leaf block number within the directory
+  uint pad2;
+};
+
+#define DXMAGIC 0x48
+#define DXMAX   (DPB - 3)   // dxents that fit in block 0
+
+// Hash of a directory entry name (FNV-1a).
+static inline uint
+dirhash(const char *name)
+{
+  uint h = 2166136261U;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = (h ^ (uchar)name[i]) * 16777619U;
+  return h;
+}
+
@@ -1,6 +1,24 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Pages are reference counted, so that copy-on-write
+// fork can share them: kalloc() returns a page with
+// a count of one, kdup() adds a reference, and kfree()
+// drops one and frees the page when none are left.
+//
+// Each CPU keeps its own free list under its own lock,
+// so CPUs allocating and freeing at the same time don't
+// contend. A CPU whose list is empty steals a batch of
+// pages from another CPU's list.
+//
+// Superpages, SUPERPGSIZE-aligned runs of 512 pages, come
+// from a separate pool. kinit() puts every aligned run of
+// free memory there, and kalloc() breaks a superpage up into
+// pages only when no CPU's list has any left. A superpage's
+// pages are counted separately, so that one can be split
+// into page mappings (see uvmdemote()); ksuperfree() returns
+// it to the pool if its pages all become free together.
 
 #include "types.h"
 #include "param.h"
@@ -14,6 +32,10 @@ void freerange(void *pa_start, void *pa_end);
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// how many pages kalloc() moves from another CPU's
+// free list when this CPU's list is empty.
+#define NSTEAL 32
+
 struct run {
   struct run *next;
 };
@@ -21,13 +43,38 @@ struct run {
 struct {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;              // pages on freelist
+} kmem[NCPU];
+
+struct {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;              // superpages on freelist
+} ksuper;
+
+// reference count of each physical page, indexed by
+// (pa - KERNBASE) / PGSIZE. updated with atomic
+// instructions rather than under a lock.
+static int refcnt[(PHYSTOP - KERNBASE) / PGSIZE];
+
+#define PA2REF(pa) (&refcnt[((uint64)(pa) - KERNBASE) / PGSIZE])
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  char *p;
+
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  initlock(&ksuper.lock, "ksuper");
+  p = (char*)SUPERPGROUNDUP((uint64)end);
+  freerange(end, p);
+  for(; p + SUPERPGSIZE <= (char*)PHYSTOP; p += SUPERPGSIZE){
+    ((struct run*)p)->next = ksuper.freelist;
+    ksuper.freelist = (struct run*)p;
+    ksuper.nfree++;
+  }
+  freerange(p, (void*)PHYSTOP);
 }
 
 void
@@ -35,31 +82,113 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    *PA2REF(p) = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// If that was the last reference, the page goes on the
+// current CPU's free list.
 void
 kfree(void *pa)
 {
   struct run *r;
+  int id, n;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  n = __sync_sub_and_fetch(PA2REF(pa), 1);
+  if(n < 0)
+    panic("kfree: ref");
+  if(n > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  kmem[id].nfree++;
+  release(&kmem[id].lock);
+  pop_off();
+}
+
+// Move up to NSTEAL pages from some other CPU's free list
+// to CPU id's free list. Returns the number of pages moved.
+// Interrupts must be off, and no kmem lock held, since
+// holding two kmem locks at once could deadlock.
+static int
+steal(int id)
+{
+  struct run *head, *tail;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    int victim = (id + i) % NCPU;
+
+    acquire(&kmem[victim].lock);
+    head = tail = kmem[victim].freelist;
+    n = 0;
+    if(head){
+      n = 1;
+      while(n < NSTEAL && tail->next){
+        tail = tail->next;
+        n++;
+      }
+      kmem[victim].freelist = tail->next;
+      kmem[victim].nfree -= n;
+    }
+    release(&kmem[victim].lock);
+
+    if(n > 0){
+      acquire(&kmem[id].lock);
+      tail->next = kmem[id].freelist;
+      kmem[id].freelist = head;
+      kmem[id].nfree += n;
+      release(&kmem[id].lock);
+      return n;
+    }
+  }
+  return 0;
+}
+
+// Break a superpage from the pool up into pages on CPU id's
+// free list. Returns the number of pages added.
+static int
+breaksuper(int id)
+{
+  struct run *r;
+  char *p;
+
+  acquire(&ksuper.lock);
+  r = ksuper.freelist;
+  if(r){
+    ksuper.freelist = r->next;
+    ksuper.nfree--;
+  }
+  release(&ksuper.lock);
+  if(r == 0)
+    return 0;
+
+  acquire(&kmem[id].lock);
+  for(p = (char*)r; p < (char*)r + SUPERPGSIZE; p += PGSIZE){
+    ((struct run*)p)->next = kmem[id].freelist;
+    kmem[id].freelist = (struct run*)p;
+  }
+  kmem[id].nfree += SUPERPGSIZE / PGSIZE;
+  release(&kmem[id].lock);
+  return SUPERPGSIZE / PGSIZE;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +198,135 @@ void *
 kalloc(void)
 {
   struct run *r;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  for(;;){
+    acquire(&kmem[id].lock);
+    r = kmem[id].freelist;
+    if(r){
+      kmem[id].freelist = r->next;
+      kmem[id].nfree--;
+    }
+    release(&kmem[id].lock);
+    if(r || (steal(id) == 0 && breaksuper(id) == 0))
+      break;
+  }
+  pop_off();
 
-  if(r)
+  if(r){
     memset((char*)r, 5, PGSIZE); // fill with junk
+    *PA2REF(r) = 1;
+  }
+  return (void*)r;
+}
+
+// Add a reference to a page returned by kalloc().
+void
+kdup(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kdup");
+  if(__sync_fetch_and_add(PA2REF(pa), 1) < 1)
+    panic("kdup: free page");
+}
+
+// About how many pages are free? Read without locks, so
+// only a hint.
+int
+kfreepages(void)
+{
+  int i, n;
+
+  n = ksuper.nfree * (SUPERPGSIZE / PGSIZE);
+  for(i = 0; i < NCPU; i++)
+    n += kmem[i].nfree;
+  return n;
+}
+
+// How many references are there to a page?
+int
+krefcnt(void *pa)
+{
+  return *PA2REF(pa);
+}
+
+// Allocate a superpage of physical memory, aligned to
+// SUPERPGSIZE, each of its pages with one reference. It is
+// not filled with junk; callers clear it.
+// Returns 0 if no superpage is free.
+void *
+ksuperalloc(void)
+{
+  struct run *r;
+  char *p;
+
+  acquire(&ksuper.lock);
+  r = ksuper.freelist;
+  if(r){
+    ksuper.freelist = r->next;
+    ksuper.nfree--;
+  }
+  release(&ksuper.lock);
+
+  if(r)
+    for(p = (char*)r; p < (char*)r + SUPERPGSIZE; p += PGSIZE)
+      *PA2REF(p) = 1;
   return (void*)r;
 }
+
+// Add a reference to each page of a superpage.
+void
+ksuperdup(void *pa)
+{
+  char *p;
+
+  for(p = pa; p < (char*)pa + SUPERPGSIZE; p += PGSIZE)
+    kdup(p);
+}
+
+// Drop a reference to each page of the superpage at pa. If
+// that frees them all, the superpage goes back to the pool;
+// otherwise the pages freed go on the page free lists.
+void
+ksuperfree(void *pa)
+{
+  uint64 freed[SUPERPGSIZE/PGSIZE/64];
+  int i, n, all;
+  char *p;
+
+  if(((uint64)pa % SUPERPGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("ksuperfree");
+
+  all = 1;
+  for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+    if(i % 64 == 0)
+      freed[i/64] = 0;
+    n = __sync_sub_and_fetch(PA2REF((char*)pa + i*PGSIZE), 1);
+    if(n < 0)
+      panic("ksuperfree: ref");
+    if(n == 0)
+      freed[i/64] |= 1L << (i%64);
+    else
+      all = 0;
+  }
+
+  if(all){
+    acquire(&ksuper.lock);
+    ((struct run*)pa)->next = ksuper.freelist;
+    ksuper.freelist = pa;
+    ksuper.nfree++;
+    release(&ksuper.lock);
+    return;
+  }
+
+  // the pages still referenced are someone else's to free.
+  for(i = 0; i < SUPERPGSIZE/PGSIZE; i++){
+    if(freed[i/64] & (1L << (i%64))){
+      p = (char*)pa + i*PGSIZE;
+      *PA2REF(p) = 1;
+      kfree(p);
+    }
+  }
+}
@@ -4,6 +4,7 @@
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
+#include "proc.h"
 #include "fs.h"
 #include "buf.h"
 
@@ -16,69 +17,188 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op(n) reserves log space for the
+// n blocks the call may write, usually MAXOPBLOCKS; if the
+// log has room for them it just returns, and otherwise it
+// sleeps until the log has been committed and checkpointed.
+// The log's size is set by mkfs and read from the superblock.
+//
+// Commits happen in the background, in the committer kernel
+// thread, so that no system call waits for them: once no FS
+// system calls are active, it commits when the transaction is
+// COMMITTICKS old, when begin_op() has found the log full, or
+// when fsync() asks it to. Transactions are numbered, and
+// fsync() waits for the one that last changed the inode
+// (ip->tseq) to commit. The committer sleeps on &ticks, so
+// that the clock wakes it once a tick; anyone who wants a
+// commit sooner wakes it the same way.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
-//   header block, containing block #s for block A, B, C, ...
-//   block A
-//   block B
-//   block C
-//   ...
-// Log appends are synchronous.
+//   header block, containing start, n and block #s
+//   cap log slots
+// The log is circular: committed transactions are appended to
+// the slots after the last committed one, wrapping around, and
+// the header lists the blocks in the n slots from start on.
+// A commit writes a transaction's blocks to the log and then
+// the header, and that is all; the blocks stay pinned in the
+// buffer cache, so reads of them are served from there, and
+// their home locations are not written yet.
+//
+// Writing them home is checkpointing, which the checkpointer
+// kernel thread does once half the log is in use, or when
+// begin_op() finds the log full. It installs the committed
+// blocks in order of block number, each only once however many
+// transactions logged it, then advances start in the header,
+// which frees those slots, and unpins the blocks. Only the
+// checkpointer writes home locations, so a block that is not
+// pinned always has its latest committed contents on disk.
+//
+// Log appends are synchronous, but the disk is handed LOGBATCH
+// blocks at a time, so that the disk sees many requests at once
+// and consecutive blocks merge into multi-block requests.
+
+// how many blocks are written at a time. each batch holds
+// up to LOGBATCH buffers beyond the pinned ones.
+#define LOGBATCH 8
+
+// how many clock ticks a transaction may stay open.
+#define COMMITTICKS 5
 
 // Contents of the header block, used for both the on-disk header block
-// and to keep track in memory of logged block# before commit.
+// and to keep track in memory of logged block#s.
+// In the header and in log.ch, the block logged in slot i is
+// block[i], for the n slots from start on; in log.lh, the
+// open transaction's blocks are block[0..n-1].
 struct logheader {
+  int start;
   int n;
-  int block[LOGSIZE];
+  int block[MAXLOG];
 };
 
 struct log {
   struct spinlock lock;
+  struct sleeplock headlock; // serializes changes to the on-disk header.
   int start;
   int size;
+  int cap;         // number of log slots.
   int outstanding; // how many FS sys calls are executing.
+  int reserved;    // log blocks they have reserved.
   int committing;  // in commit(), please wait.
+  int full;        // begin_op() is waiting for log space.
+  int force;       // fsync() is waiting for a commit.
+  uint seq;        // number of the open transaction.
+  uint done;       // number of the last committed transaction.
+  uint opened;     // ticks when the open transaction logged its first block.
   int dev;
-  struct logheader lh;
+  struct logheader lh; // the open transaction.
+  struct logheader ch; // committed but not yet checkpointed.
 };
 struct log log;
 
+// The checkpointer's list of blocks to install, and private
+// buffers to write them from, so that it never holds more than
+// one cache buffer's lock; FS system calls lock cache buffers
+// in no particular order.
+static struct {
+  int n;
+  int block[MAXLOG];
+  int slot[MAXLOG];     // the latest slot logging block[i].
+  int count[MAXLOG];    // how many slots log block[i].
+  struct buf *buf[MAXLOG];
+  struct buf wbuf[LOGBATCH];
+} ck;
+
 static void recover_from_log(void);
 static void commit();
+static void committer(void);
+static void checkpointer(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
   initlock(&log.lock, "log");
+  initsleeplock(&log.headlock, "loghead");
+  for (i = 0; i < LOGBATCH; i++)
+    initsleeplock(&ck.wbuf[i].lock, "ckbuf");
   log.start = sb->logstart;
   log.size = sb->nlog;
+  log.cap = log.size - 1;
+  if (log.cap > MAXLOG)
+    log.cap = MAXLOG;
+  if (log.cap < 2*MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  kthread(committer, "committer");
+  kthread(checkpointer, "checkpointer");
 }
 
-// Copy committed blocks from log to their home location
+// The disk block of log slot i.
+static int
+slotblock(int i)
+{
+  return log.start + 1 + i;
+}
+
+// Fill ck with the blocks logged in the n slots of h from
+// start on, each once with its latest slot, sorted by block number.
 static void
-install_trans(int recovering)
-{
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+ckcollect(struct logheader *h, int start, int n)
+{
+  int i, j, slot, b;
+
+  ck.n = 0;
+  for (i = 0; i < n; i++) {
+    slot = (start + i) % log.cap;
+    b = h->block[slot];
+    for (j = 0; j < ck.n && ck.block[j] != b; j++)
+      ;
+    if (j == ck.n) {
+      ck.block[ck.n] = b;
+      ck.count[ck.n] = 0;
+      ck.n++;
+    }
+    ck.slot[j] = slot;
+    ck.count[j]++;
+  }
+  for (i = 1; i < ck.n; i++) {
+    for (j = i; j > 0 && ck.block[j-1] > ck.block[j]; j--) {
+      b = ck.block[j]; ck.block[j] = ck.block[j-1]; ck.block[j-1] = b;
+      b = ck.slot[j]; ck.slot[j] = ck.slot[j-1]; ck.slot[j-1] = b;
+      b = ck.count[j]; ck.count[j] = ck.count[j-1]; ck.count[j-1] = b;
+    }
+  }
+}
+
+// Copy the committed blocks from the log to their home
+// locations after a crash.
+static void
+install_trans(void)
+{
+  struct buf *dbuf[LOGBATCH];
+  int tail, i, n;
+
+  ckcollect(&log.ch, log.ch.start, log.ch.n);
+  for (tail = 0; tail < ck.n; tail += n) {
+    n = ck.n - tail;
+    if(n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, slotblock(ck.slot[tail+i])); // read log block
+      dbuf[i] = bread(log.dev, ck.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwritev(dbuf, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
   }
 }
 
@@ -89,25 +209,31 @@ read_head(void)
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  log.ch.start = lh->start;
+  log.ch.n = lh->n;
+  if (log.ch.start < 0 || log.ch.start >= log.cap ||
+      log.ch.n < 0 || log.ch.n > log.cap)
+    panic("read_head");
+  for (i = 0; i < log.cap; i++) {
+    log.ch.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
 // Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// This is the true point at which a
+// transaction commits, and at which a checkpoint
+// frees log slots. Caller holds log.headlock.
 static void
 write_head(void)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->start = log.ch.start;
+  hb->n = log.ch.n;
+  for (i = 0; i < log.cap; i++) {
+    hb->block[i] = log.ch.block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -117,24 +243,42 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
+  install_trans(); // if committed, copy from log to disk
+  log.ch.start = 0;
+  log.ch.n = 0;
+  acquiresleep(&log.headlock);
   write_head(); // clear the log
+  releasesleep(&log.headlock);
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call, which
+// may write up to n blocks.
 void
-begin_op(void)
+begin_op(int n)
 {
+  struct proc *p = myproc();
+
+  if(n > log.cap)
+    panic("begin_op: too big a transaction");
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.ch.n + log.lh.n + log.reserved + n > log.cap){
+      // this op might exhaust log space; wait for commit
+      // and checkpoint.
+      if(!log.full){
+        log.full = 1;
+        if(log.outstanding == 0)
+          wakeup(&ticks);
+        wakeup(&log.ch);
+      }
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      p->logres = n;
+      p->logused = 0;
       release(&log.lock);
       break;
     }
@@ -142,69 +286,261 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// wakes the committer if this was the last outstanding
+// operation and a commit is wanted now.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
+  log.reserved -= myproc()->logres;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  if(log.outstanding == 0 && (log.full || log.force))
+    wakeup(&ticks);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.reserved has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// The most blocks one FS system call should reserve, so
+// that several of them fit in the log at once.
+int
+log_maxop(void)
+{
+  int n = log.cap / 4;
+
+  return n > MAXOPBLOCKS ? n : MAXOPBLOCKS;
+}
+
+// The number of the open transaction, the one that any
+// changes the caller makes now will be part of.
+uint
+log_seq(void)
+{
+  return log.seq;
+}
+
+// Wait until transaction seq has committed.
+void
+log_force(uint seq)
+{
+  acquire(&log.lock);
+  while(log.done < seq){
+    if(!log.force){
+      log.force = 1;
+      wakeup(&ticks);
+    }
+    sleep(&log, &log.lock);
   }
   release(&log.lock);
+}
+
+// Should the committer commit now? Caller holds log.lock.
+static int
+commitdue(void)
+{
+  if(log.outstanding > 0)
+    return 0;
+  if(log.force)
+    return 1;
+  return log.lh.n > 0 && (log.full || ticks - log.opened >= COMMITTICKS);
+}
+
+// The committer kernel thread.
+static void
+committer(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    while(!commitdue())
+      sleep(&ticks, &log.lock);
+    log.committing = 1;
+    release(&log.lock);
 
-  if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
     commit();
+
     acquire(&log.lock);
     log.committing = 0;
+    log.full = 0;
+    log.force = 0;
+    log.done = log.seq++;
+    if(log.ch.n > log.cap/2)
+      wakeup(&log.ch);
     wakeup(&log);
-    release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy modified blocks from cache to the free log slots
+// after the committed ones.
 static void
 write_log(void)
 {
-  int tail;
+  struct buf *to[LOGBATCH];
+  int head, tail, i, n;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  acquire(&log.lock);
+  head = log.ch.start + log.ch.n;
+  release(&log.lock);
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if(n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++) {
+      to[i] = bread(log.dev, slotblock((head+tail+i) % log.cap)); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwritev(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
 static void
 commit()
 {
+  int i;
+
   if (log.lh.n > 0) {
     write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
+    acquiresleep(&log.headlock);
+    acquire(&log.lock);
+    for (i = 0; i < log.lh.n; i++)
+      log.ch.block[(log.ch.start + log.ch.n + i) % log.cap] = log.lh.block[i];
+    log.ch.n += log.lh.n;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    release(&log.lock);
+    write_head();    // Write header to disk -- the real commit
+    releasesleep(&log.headlock);
+  }
+}
+
+// Is block b logged by the open transaction, or by a committed
+// slot after the first n? Caller holds log.lock.
+static int
+loggedsince(int b, int n)
+{
+  int i;
+
+  for (i = 0; i < log.lh.n; i++)
+    if (log.lh.block[i] == b)
+      return 1;
+  for (i = n; i < log.ch.n; i++)
+    if (log.ch.block[(log.ch.start + i) % log.cap] == b)
+      return 2;
+  return 0;
+}
+
+// Write the blocks of the first n committed slots home, and
+// free those slots.
+static void
+checkpoint(int n)
+{
+  struct buf *w[LOGBATCH];
+  struct buf *bp, *lbuf;
+  int i, k, m, later;
+
+  ckcollect(&log.ch, log.ch.start, n);
+  m = 0;
+  for (i = 0; i < ck.n; i++) {
+    // pinned, so this finds the cached copy.
+    bp = bread(log.dev, ck.block[i]);
+    ck.buf[i] = bp;
+    // holding bp's lock keeps anyone from changing the block
+    // and logging it meanwhile.
+    acquire(&log.lock);
+    later = loggedsince(ck.block[i], n);
+    release(&log.lock);
+    if (later == 2) {
+      // a later checkpoint will write the newer contents.
+      brelse(bp);
+      continue;
+    }
+    w[m] = &ck.wbuf[m];
+    acquiresleep(&w[m]->lock);
+    w[m]->dev = log.dev;
+    w[m]->blockno = ck.block[i];
+    if (later) {
+      // the cached copy has uncommitted changes; the log
+      // has the committed contents.
+      brelse(bp);
+      lbuf = bread(log.dev, slotblock(ck.slot[i]));
+      memmove(w[m]->data, lbuf->data, BSIZE);
+      brelse(lbuf);
+    } else {
+      memmove(w[m]->data, bp->data, BSIZE);
+      brelse(bp);
+    }
+    if (++m == LOGBATCH) {
+      bwritev(w, m);  // write home locations
+      for (k = 0; k < m; k++)
+        releasesleep(&w[k]->lock);
+      m = 0;
+    }
+  }
+  if (m > 0) {
+    bwritev(w, m);
+    for (k = 0; k < m; k++)
+      releasesleep(&w[k]->lock);
+  }
+
+  acquiresleep(&log.headlock);
+  acquire(&log.lock);
+  log.ch.start = (log.ch.start + n) % log.cap;
+  log.ch.n -= n;
+  release(&log.lock);
+  write_head();    // free the slots
+  releasesleep(&log.headlock);
+
+  for (i = 0; i < ck.n; i++)
+    for (k = 0; k < ck.count[i]; k++)
+      bunpin(ck.buf[i]);
+}
+
+// Should the checkpointer checkpoint now? Caller holds log.lock.
+static int
+checkpointdue(void)
+{
+  return log.ch.n > log.cap/2 || (log.full && log.ch.n > 0);
+}
+
+// The checkpointer kernel thread.
+static void
+checkpointer(void)
+{
+  int n;
+
+  acquire(&log.lock);
+  for(;;){
+    while(!checkpointdue())
+      sleep(&log.ch, &log.lock);
+    release(&log.lock);
+
+    // only slots whose commit is on disk may be checkpointed.
+    acquiresleep(&log.headlock);
+    acquire(&log.lock);
+    n = log.ch.n;
+    release(&log.lock);
+    releasesleep(&log.headlock);
+    checkpoint(n);
+
+    acquire(&log.lock);
+    // begin_op() may be waiting for log space.
+    log.full = 0;
+    wakeup(&log);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
-// commit()/write_log() will do the disk write.
+// commit()/write_log() will write it to the log, and
+// checkpoint() to its home location.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -217,7 +553,7 @@ log_write(struct buf *b)
   int i;
 
   acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -228,8 +564,11 @@ log_write(struct buf *b)
   }
   log.lh.block[i] = b->blockno;
   if (i == log.lh.n) {  // Add new block to log?
+    if (++myproc()->logused > myproc()->logres)
+      panic("log_write: over reservation");
     bpin(b);
-    log.lh.n++;
+    if(log.lh.n++ == 0)
+      log.opened = ticks;
   }
   release(&log.lock);
 }
@@ -11,6 +11,7 @@ void
 main()
 {
   if(cpuid() == 0){
+    lockinit();      // lockstat()'s list of locks
     consoleinit();
     printfinit();
     printf("\n");
@@ -26,7 +27,9 @@ main()
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    dcinit();        // directory entry cache
     fileinit();      // file table
+    mmapinit();      // pages of files mapped shared
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
@@ -62,6 +62,14 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   mapped files (mmap), growing down from MMAPTOP
+//   ...
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
+//
+// User memory ends at USERTOP, below the devices, so that a
+// process's kernel page table can map it too (see kvmcreate()).
+// USERTOP must be a multiple of 2MB.
+#define USERTOP PLIC
+#define MMAPTOP USERTOP
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
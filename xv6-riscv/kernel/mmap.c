@@ -0,0 +1,465 @@
+// Memory-mapped files.
+//
+// mmap() records a region of the file in one of the process's
+// VMAs (p->vma[]), below the mappings already there and above
+// the heap, and maps nothing. vmfault() calls mmapfault() when
+// the process first touches a page of the region, which reads
+// the page from the inode, so a program reading a mapped file
+// gets the data with one copy, from the buffer cache, instead
+// of two.
+//
+// All MAP_SHARED mappings of a page of a file, in any process,
+// map the same physical page, which mpages[] records. Its
+// pages are first mapped read-only; the first write faults,
+// and mmapfault() makes the page writable and marks it dirty.
+// When munmap(), exec() or exit() removes the last mapping of
+// a dirty page, the page is written back to the file through
+// the log, in a transaction of its own. write() copies what
+// it writes into the file's mapped pages too, so the write-
+// back doesn't undo it; but read() reads the file, and sees
+// what was written through a mapping only once it has been
+// written back. Writes never extend the file.
+// A MAP_PRIVATE mapping's pages are the process's own, copied
+// from the shared page if there is one, and are never
+// written back.
+//
+// fork() gives the child the parent's mappings. Pages of a
+// shared mapping are shared by both; pages of a private one
+// are copy-on-write, like the rest of memory.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+
+// A page of a file that MAP_SHARED mappings map. It holds no
+// reference to the page; the mappings' PTEs do. Entries of
+// an inode are added, and their pages written by writei() and
+// written back, holding the inode's lock. mpages.lock protects
+// the table, and is held while a mapping of a page is added or
+// dropped, so that the page's reference count says how many
+// mappings it has.
+struct mpage {
+  struct inode *ip;   // 0 if the entry is free
+  uint off;           // the page's offset in the file
+  uint64 pa;
+  int dirty;          // written through a mapping
+};
+
+struct {
+  struct spinlock lock;
+  struct mpage page[NMPAGE];
+} mpages;
+
+void
+mmapinit(void)
+{
+  initlock(&mpages.lock, "mpages");
+}
+
+// The entry for the page at off in ip, or 0.
+// Caller holds mpages.lock.
+static struct mpage*
+mpagefind(struct inode *ip, uint off)
+{
+  struct mpage *m;
+
+  for(m = mpages.page; m < &mpages.page[NMPAGE]; m++)
+    if(m->ip == ip && m->off == off)
+      return m;
+  return 0;
+}
+
+// writei() wrote n bytes, from src, at off in ip, within one
+// page: put them in the page, if it is mapped.
+// Caller holds ip's lock.
+void
+mmapwrite(struct inode *ip, uint off, char *src, uint n)
+{
+  struct mpage *m;
+
+  acquire(&mpages.lock);
+  if((m = mpagefind(ip, PGROUNDDOWN(off))) != 0)
+    memmove((char*)m->pa + (off - m->off), src, n);
+  release(&mpages.lock);
+}
+
+// The VMA of p that holds va, or 0.
+static struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va >= v->start && va < v->start + v->len)
+      return v;
+  return 0;
+}
+
+// Does [va, va+len) overlap one of p's VMAs?
+static int
+overlaps(struct proc *p, uint64 va, uint64 len)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && va < v->start + v->len && v->start < va + len)
+      return 1;
+  return 0;
+}
+
+// The lowest address of any of p's mappings: the heap may
+// grow up to here.
+uint64
+mmapbase(struct proc *p)
+{
+  struct vma *v;
+  uint64 base = MMAPTOP;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->len && v->start < base)
+      base = v->start;
+  return base;
+}
+
+// Map len bytes of file f, from offset off, into the current
+// process: at addr if that is free, or else at the highest
+// free place below MMAPTOP. Return the address, or -1.
+uint64
+mmap(uint64 addr, uint64 len, int prot, int flags, struct file *f, uint64 off)
+{
+  struct proc *p = myproc();
+  struct vma *v, *u;
+  uint64 va;
+
+  if(len == 0 || len > MMAPTOP || off % PGSIZE != 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(f->type != FD_INODE || !f->readable)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+    return -1;
+  len = PGROUNDUP(len);
+  // no file is bigger, and file offsets fit in a uint.
+  if(off > (uint64)MAXFILE*BSIZE || len > (uint64)MAXFILE*BSIZE - off)
+    return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA] && v->len; v++)
+    ;
+  if(v == &p->vma[NVMA])
+    return -1;
+
+  va = addr;
+  if(va == 0 || va % PGSIZE != 0 || va < PGROUNDUP(p->sz) ||
+     va > MMAPTOP - len || overlaps(p, va, len)){
+    // each VMA that is in the way moves the candidate
+    // below it, so this looks at each VMA at most once.
+    va = MMAPTOP - len;
+    for(;;){
+      for(u = p->vma; u < &p->vma[NVMA]; u++)
+        if(u->len && va < u->start + u->len && u->start < va + len)
+          break;
+      if(u == &p->vma[NVMA])
+        break;
+      if(u->start < len)
+        return -1;
+      va = u->start - len;
+    }
+    if(va < PGROUNDUP(p->sz))
+      return -1;
+  }
+
+  ilock(f->ip);
+  if(f->ip->type != T_FILE){
+    iunlock(f->ip);
+    return -1;
+  }
+  iunlock(f->ip);
+
+  v->start = va;
+  v->len = len;
+  v->prot = prot;
+  v->flags = flags;
+  v->off = off;
+  v->f = filedup(f);
+  return va;
+}
+
+// Unmap the page that *pte maps, of ip's shared mappings, and
+// drop its reference; free its entry if that was its last
+// mapping. But if it is the last mapping of a dirty page,
+// leave it, and return 1 so that the caller writes the page
+// back, after marking it clean if clean is set. Deciding that
+// and dropping the reference happen together under
+// mpages.lock, so of two processes that unmap a page at once,
+// one sees that it has the last mapping.
+static int
+mpagedrop(struct inode *ip, pte_t *pte, int clean)
+{
+  struct mpage *m;
+  uint64 pa = PTE2PA(*pte);
+
+  acquire(&mpages.lock);
+  for(m = mpages.page; m < &mpages.page[NMPAGE]; m++)
+    if(m->ip == ip && m->pa == pa)
+      break;
+  if(m < &mpages.page[NMPAGE] && krefcnt((void*)pa) == 1){
+    if(m->dirty){
+      if(clean)
+        m->dirty = 0;
+      release(&mpages.lock);
+      return 1;
+    }
+    m->ip = 0;
+    ip->nmpage--;
+  }
+  *pte = 0;
+  kfree((void*)pa);
+  release(&mpages.lock);
+  return 0;
+}
+
+// Handle a fault at page-aligned va, which is not mapped or
+// is mapped read-only, for p's mappings. Returns the physical
+// address of the page, or 0 if va is not in a mapping that
+// allows the access, or memory ran out.
+uint64
+mmapfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  struct inode *ip;
+  struct mpage *m;
+  pte_t *pte;
+  char *mem;
+  uint off;
+  int perm;
+
+  if((v = findvma(p, va)) == 0)
+    return 0;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return 0;
+  if(v->prot == 0)
+    return 0;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte != 0 && (*pte & PTE_V) != 0){
+    // a write to a clean page of a shared mapping.
+    if(!write || (*pte & PTE_COW) || v->flags != MAP_SHARED)
+      return 0;
+    acquire(&mpages.lock);
+    for(m = mpages.page; m < &mpages.page[NMPAGE]; m++)
+      if(m->ip && m->pa == PTE2PA(*pte))
+        m->dirty = 1;
+    release(&mpages.lock);
+    *pte |= PTE_W | PTE_D;
+    return PTE2PA(*pte);
+  }
+
+  // read() and write() fault in a buffer that may be in this
+  // mapping before they lock any file (see uvmprefault()), so
+  // the process holds no inode or buffer lock here.
+  // make the page-table pages now, so that mappages() below
+  // can't fail once the page has an entry in mpages[].
+  if(walk(p->pagetable, va, 1) == 0)
+    return 0;
+  if((mem = kallocswap()) == 0)
+    return 0;
+  ip = v->f->ip;
+  off = v->off + (va - v->start);
+  ilock(ip);
+  acquire(&mpages.lock);
+  m = mpagefind(ip, off);
+  if(m != 0 && v->flags == MAP_SHARED){
+    kfree(mem);
+    mem = (char*)m->pa;
+    kdup(mem);
+    m->dirty |= write;
+    release(&mpages.lock);
+  } else if(m != 0){
+    memmove(mem, (char*)m->pa, PGSIZE);
+    release(&mpages.lock);
+  } else {
+    release(&mpages.lock);
+    // the part of the page beyond the end of the file
+    // stays zero.
+    memset(mem, 0, PGSIZE);
+    if(readi(ip, 0, (uint64)mem, off, PGSIZE) < 0){
+      iunlock(ip);
+      kfree(mem);
+      return 0;
+    }
+    if(v->flags == MAP_SHARED){
+      acquire(&mpages.lock);
+      for(m = mpages.page; m < &mpages.page[NMPAGE] && m->ip; m++)
+        ;
+      if(m < &mpages.page[NMPAGE]){
+        m->ip = ip;
+        m->off = off;
+        m->pa = (uint64)mem;
+        m->dirty = write;
+        ip->nmpage++;
+      }
+      release(&mpages.lock);
+      if(m == &mpages.page[NMPAGE]){
+        // too many pages are mapped shared.
+        iunlock(ip);
+        kfree(mem);
+        return 0;
+      }
+    }
+  }
+
+  // a writable page must be readable too.
+  perm = PTE_U;
+  if(v->prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;
+  if(v->prot & PROT_EXEC)
+    perm |= PTE_X;
+  if((v->prot & PROT_WRITE) && (v->flags == MAP_PRIVATE || write))
+    perm |= PTE_W;
+  if((v->prot & PROT_WRITE) && v->flags == MAP_SHARED && write)
+    perm |= PTE_D;
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0)
+    panic("mmapfault");
+  iunlock(ip);
+  return (uint64)mem;
+}
+
+// Unmap v's mapping in pagetable from va to va+len, writing
+// back the dirty pages of which it was the last mapping.
+static void
+unmappages(struct vma *v, pagetable_t pagetable, uint64 va, uint64 len)
+{
+  struct inode *ip = v->f->ip;
+  uint64 a, off, pa;
+  pte_t *pte;
+  uint n;
+
+  for(a = va; a < va + len && v->flags == MAP_SHARED; a += PGSIZE){
+    if((pte = walk(pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(mpagedrop(ip, pte, 0) == 0)
+      continue;
+    // the last mapping of a dirty page. the transaction must
+    // begin before ip is locked; with ip locked, no process
+    // can map the page again until it is written back.
+    pa = PTE2PA(*pte);
+    off = v->off + (a - v->start);
+    begin_op(writecost(PGSIZE));
+    ilock(ip);
+    if(mpagedrop(ip, pte, 1)){
+      if(off < ip->size){
+        n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+        writei(ip, 0, pa, off, n);
+      }
+      mpagedrop(ip, pte, 0);
+    }
+    iunlock(ip);
+    end_op();
+  }
+  uvmunmap(pagetable, va, len/PGSIZE, 1);
+}
+
+// Remove the mappings in [va, va+len) of the current process,
+// which must lie in one of its VMAs. The VMA shrinks, or is
+// split in two if the range is in its middle.
+int
+munmap(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  struct vma *v, *w;
+  uint64 end;
+
+  if(va % PGSIZE != 0 || len == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if((v = findvma(p, va)) == 0 || va + len > v->start + v->len)
+    return -1;
+  end = v->start + v->len;
+
+  if(va > v->start && va + len < end){
+    for(w = p->vma; w < &p->vma[NVMA] && w->len; w++)
+      ;
+    if(w == &p->vma[NVMA])
+      return -1;
+    *w = *v;
+    w->start = va + len;
+    w->len = end - w->start;
+    w->off = v->off + (w->start - v->start);
+    filedup(w->f);
+    v->len = va - v->start;
+    unmappages(v, p->pagetable, va, len);
+    uvmflush();
+    return 0;
+  }
+
+  unmappages(v, p->pagetable, va, len);
+  uvmflush();
+  if(va == v->start){
+    v->start += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0){
+    fileclose(v->f);
+    v->f = 0;
+    v->start = 0;
+  }
+  return 0;
+}
+
+// Remove all of p's mappings from pagetable, writing
+// dirty pages back. For exec() and exit().
+void
+munmapall(struct proc *p, pagetable_t pagetable)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->len == 0)
+      continue;
+    unmappages(v, pagetable, v->start, v->len);
+    fileclose(v->f);
+    v->f = 0;
+    v->start = 0;
+    v->len = 0;
+  }
+}
+
+// Give np the mappings of p, for fork(). Returns 0, or -1
+// with nothing mapped in np if memory ran out.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v, *nv, *w;
+
+  for(v = p->vma, nv = np->vma; v < &p->vma[NVMA]; v++, nv++){
+    if(v->len == 0)
+      continue;
+    if(uvmcopyrange(p->pagetable, np->pagetable, v->start, v->len,
+                    v->flags == MAP_SHARED) < 0){
+      for(w = np->vma; w < nv; w++){
+        if(w->len == 0)
+          continue;
+        uvmunmap(np->pagetable, w->start, w->len/PGSIZE, 1);
+        fileclose(w->f);
+        w->f = 0;
+        w->start = 0;
+        w->len = 0;
+      }
+      return -1;
+    }
+    *nv = *v;
+    filedup(nv->f);
+  }
+  return 0;
+}
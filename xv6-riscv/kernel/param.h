@@ -1,13 +1,19 @@
 #define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mapped regions per process
+#define NMPAGE      512  // pages of files mapped shared, per system
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum number of in-memory i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NSEG          4  // max loadable segments in a program
+#define MAXOPBLOCKS  10  // max # of blocks an FS op writes, unless it says
+#define LOGSIZE      (MAXOPBLOCKS*12) // default data blocks in on-disk log
+#define MAXLOG       250 // max data blocks in on-disk log
+#define NBUF         (MAXLOG+MAXOPBLOCKS*6)  // size of disk block cache
+#define FSSIZE       20000 // size of file system in blocks
+#define SWAPSIZE     32768 // default blocks in swap area, after the file system
+#define MAXSWAP      65536 // max blocks in swap area
 #define MAXPATH      128   // maximum file path name
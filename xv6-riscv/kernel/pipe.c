@@ -7,16 +7,34 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of whole pages. It starts as one
+// page and grows a page at a time, whenever a writer finds it
+// full, until it reaches pi->limit, which fcntl(F_SETPIPE_SZ)
+// can set to at most PIPEMAX bytes.
+#define PIPESIZE  PGSIZE        // initial buffer size
+#define PIPELIMIT (4*PGSIZE)    // default limit
+#define PIPEMAX   (16*PGSIZE)   // largest limit
+
+// pipewrite() and piperead() copy user data through a buffer
+// on the kernel stack, since copyin() and copyout() may sleep
+// and so can't be called with pi->lock held.
+#define PIPECHUNK 512
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAX/PGSIZE];  // the buffer's pages, in ring order
+  uint size;      // bytes in the buffer, a multiple of PGSIZE
+  uint limit;     // size the buffer may grow to
+  uint rpos;      // where byte nread is in the buffer
   uint nread;     // number of bytes read
-  uint nwrite;    // number of bytes written
+  uint nwrite;    // number of bytes written, and so the pipe
+                  // holds nwrite - nread, even once they wrap
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rwait;      // a reader may be sleeping on nread
+  int wwait;      // a writer may be sleeping on nwrite
 };
 
 int
@@ -30,10 +48,13 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((pi = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(pi, 0, sizeof(*pi));
+  if((pi->page[0] = kalloc()) == 0)
+    goto bad;
+  pi->size = PIPESIZE;
+  pi->limit = PIPELIMIT;
   pi->readopen = 1;
   pi->writeopen = 1;
-  pi->nwrite = 0;
-  pi->nread = 0;
   initlock(&pi->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -68,36 +89,110 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
+    freelock(&pi->lock);
+    for(int i = 0; i < pi->size/PGSIZE; i++)
+      kfree(pi->page[i]);
     kfree((char*)pi);
   } else
     release(&pi->lock);
 }
 
+// Add a page to a full buffer, at the write position, so
+// that the free space is the PGSIZE bytes starting there.
+// If the write position is inside a page, the bytes of that
+// page that come after it (the oldest in the pipe) move to
+// the same offsets in the new page. Caller holds pi->lock.
+static int
+pipegrow(struct pipe *pi)
+{
+  uint w, j, o, i;
+  char *pg;
+
+  if(pi->size >= pi->limit || (pg = kalloc()) == 0)
+    return -1;
+  w = (pi->rpos + (pi->nwrite - pi->nread)) % pi->size;
+  j = w / PGSIZE;
+  o = w % PGSIZE;
+  if(o != 0){
+    memmove(pg + o, pi->page[j] + o, PGSIZE - o);
+    j++;
+  }
+  for(i = pi->size/PGSIZE; i > j; i--)
+    pi->page[i] = pi->page[i-1];
+  pi->page[j] = pg;
+  pi->size += PGSIZE;
+  // the oldest byte, nread, moves up a page; w stays put.
+  pi->rpos = (w + PGSIZE) % pi->size;
+  return 0;
+}
+
+// Copy n bytes between buf and the ring at stream offset off,
+// which is between nread and nwrite, a page-contiguous run at
+// a time. Caller holds pi->lock.
+static void
+pipecopy(struct pipe *pi, uint off, char *buf, int n, int toring)
+{
+  uint pos, m;
+
+  while(n > 0){
+    pos = (pi->rpos + (off - pi->nread)) % pi->size;
+    m = PGSIZE - pos % PGSIZE;
+    if(m > n)
+      m = n;
+    if(toring)
+      memmove(pi->page[pos/PGSIZE] + pos%PGSIZE, buf, m);
+    else
+      memmove(buf, pi->page[pos/PGSIZE] + pos%PGSIZE, m);
+    off += m;
+    buf += m;
+    n -= m;
+  }
+}
+
 int
 pipewrite(struct pipe *pi, uint64 addr, int n)
 {
-  int i = 0;
+  int i = 0, j, m, k;
   struct proc *pr = myproc();
+  char buf[PIPECHUNK];
 
-  acquire(&pi->lock);
   while(i < n){
-    if(pi->readopen == 0 || pr->killed){
-      release(&pi->lock);
-      return -1;
+    m = n - i;
+    if(m > PIPECHUNK)
+      m = PIPECHUNK;
+    if(copyin(pr->pagetable, buf, addr + i, m) == -1)
+      break;
+
+    acquire(&pi->lock);
+    for(j = 0; j < m; ){
+      if(pi->readopen == 0 || pr->killed){
+        release(&pi->lock);
+        return -1;
+      }
+      if(pi->nwrite == pi->nread + pi->size && pipegrow(pi) < 0){ //DOC: pipewrite-full
+        if(pi->rwait){
+          pi->rwait = 0;
+          wakeup(&pi->nread);
+        }
+        pi->wwait = 1;
+        sleep(&pi->nwrite, &pi->lock);
+        continue;
+      }
+      k = pi->nread + pi->size - pi->nwrite;
+      if(k > m - j)
+        k = m - j;
+      pipecopy(pi, pi->nwrite, buf + j, k, 1);
+      pi->nwrite += k;
+      j += k;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    // wake readers once per chunk, and only if one is waiting.
+    if(pi->rwait){
+      pi->rwait = 0;
       wakeup(&pi->nread);
-      sleep(&pi->nwrite, &pi->lock);
-    } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
-        break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
     }
+    release(&pi->lock);
+    i += m;
   }
-  wakeup(&pi->nread);
-  release(&pi->lock);
 
   return i;
 }
@@ -107,7 +202,7 @@ piperead(struct pipe *pi, uint64 addr, int n)
 {
   int i;
   struct proc *pr = myproc();
-  char ch;
+  char buf[PIPECHUNK];
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
@@ -115,16 +210,51 @@ piperead(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
+    pi->rwait = 1;
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
-      break;
+  i = pi->nwrite - pi->nread;  //DOC: piperead-copy
+  if(i > n)
+    i = n;
+  if(i > PIPECHUNK)
+    i = PIPECHUNK;
+  pipecopy(pi, pi->nread, buf, i, 0);
+  pi->nread += i;
+  pi->rpos = (pi->rpos + i) % pi->size;
+  if(pi->wwait){  //DOC: piperead-wakeup
+    pi->wwait = 0;
+    wakeup(&pi->nwrite);
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
+
+  if(i > 0 && copyout(pr->pagetable, addr, buf, i) == -1)
+    return -1;
   return i;
 }
+
+// fcntl(F_GETPIPE_SZ) and fcntl(F_SETPIPE_SZ, n). Setting
+// rounds n up to whole pages and caps it at PIPEMAX; it only
+// limits growth, so the buffer never shrinks below its current
+// size. Both return the limit.
+int
+pipefcntl(struct pipe *pi, int cmd, int n)
+{
+  int r;
+
+  acquire(&pi->lock);
+  if(cmd == F_SETPIPE_SZ){
+    if(n <= 0 || n > PIPEMAX){
+      release(&pi->lock);
+      return -1;
+    }
+    pi->limit = PGROUNDUP(n);
+    if(pi->limit < pi->size)
+      pi->limit = pi->size;
+  } else if(cmd != F_GETPIPE_SZ){
+    release(&pi->lock);
+    return -1;
+  }
+  r = pi->limit;
+  release(&pi->lock);
+  return r;
+}
@@ -12,10 +12,41 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// per-CPU queues of RUNNABLE processes, in FIFO order.
+// a RUNNABLE process is on exactly one queue, except while
+// a scheduler is taking it off to run it.
+// a run queue's lock may be acquired while holding a p->lock,
+// but not the other way around.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int n;                // length, read without the lock as a hint
+} runq[NCPU];
+
+// sleeping processes, hashed on chan into NSLEEPQ queues, so
+// that wakeup() looks only at processes that might be sleeping
+// on its chan. sleep() adds a process and removes it again when
+// it wakes. lock order: the lock passed to sleep(), then a sleep
+// queue's lock, then p->lock.
+#define NSLEEPQ 61
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+static struct sleepq*
+sqhash(void *chan)
+{
+  return &sleepq[((uint64)chan >> 3) % NSLEEPQ];
+}
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
@@ -50,6 +81,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->kstack = KSTACK((int) (p - proc));
@@ -85,6 +120,67 @@ myproc(void) {
   return p;
 }
 
+// Mark p RUNNABLE and append it to the run queue of the CPU
+// it last ran on, so that it tends to find its cache warm.
+// p->lock must be held.
+static void
+runnable(struct proc *p)
+{
+  struct runq *q = &runq[p->cpu];
+
+  p->state = RUNNABLE;
+  acquire(&q->lock);
+  p->rqnext = 0;
+  if(q->tail)
+    q->tail->rqnext = p;
+  else
+    q->head = p;
+  q->tail = p;
+  q->n++;
+  release(&q->lock);
+}
+
+// Remove and return the process at the head of CPU id's
+// run queue, or 0 if it is empty.
+static struct proc*
+dequeue(int id)
+{
+  struct runq *q = &runq[id];
+  struct proc *p;
+
+  acquire(&q->lock);
+  p = q->head;
+  if(p){
+    q->head = p->rqnext;
+    if(q->head == 0)
+      q->tail = 0;
+    q->n--;
+    p->rqnext = 0;
+  }
+  release(&q->lock);
+  return p;
+}
+
+// An idle CPU takes a process from the run queue of
+// some other CPU, looking only at queues that seem
+// non-empty so that idle CPUs don't bounce the locks
+// of busy ones.
+static struct proc*
+steal(int id)
+{
+  struct proc *p;
+  int i, j;
+
+  for(i = 1; i < NCPU; i++){
+    j = (id + i) % NCPU;
+    if(runq[j].n == 0)
+      continue;
+    if((p = dequeue(j)) != 0)
+      return p;
+  }
+  return 0;
+}
+
 int
 allocpid() {
   int pid;
@@ -135,6 +231,14 @@ found:
     return 0;
   }
 
+  // The kernel page table to use while it runs.
+  p->kpagetable = kvmcreate(p->pagetable);
+  if(p->kpagetable == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -153,13 +257,21 @@ freeproc(struct proc *p)
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
+  if(p->kpagetable)
+    kfree((void*)p->kpagetable);
+  p->kpagetable = 0;
+  p->asidgen = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
   p->pid = 0;
+  p->cpu = 0;
   p->parent = 0;
   p->name[0] = 0;
+  p->nsyscall = 0;
+  p->exe = 0;
+  p->nseg = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
@@ -242,26 +354,34 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  runnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing is lazy: it only raises p->sz, and vmfault()
+// allocates a zeroed page, or superpage, when the process
+// first uses it. Shrinking into the middle of a superpage
+// splits it first.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
 {
-  uint sz;
+  uint64 sz;
   struct proc *p = myproc();
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > mmapbase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
+    if(PGROUNDUP(sz + n) % SUPERPGSIZE != 0 &&
+       uvmdemote(p->pagetable, PGROUNDUP(sz + n)) < 0)
+      return -1;
     sz = uvmdealloc(p->pagetable, sz, sz + n);
+    uvmflush();
   }
   p->sz = sz;
   return 0;
@@ -276,18 +396,27 @@ fork(void)
   struct proc *np;
   struct proc *p = myproc();
 
+  // Make room for the child's page tables, which are
+  // allocated under np->lock, where swapout() can't be used.
+  swapreserve(8 + p->sz/SUPERPGSIZE + NVMA);
+
   // Allocate process.
   if((np = allocproc()) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child. The parent's
+  // writable pages become copy-on-write, so its TLB entries
+  // for them must go.
+  np->sz = p->sz;
+  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0 ||
+     mmapfork(p, np) < 0){
+    uvmflush();
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  uvmflush();
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -300,6 +429,10 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  if(p->exe)
+    np->exe = idup(p->exe);
+  np->nseg = p->nseg;
+  memmove(np->seg, p->seg, sizeof(p->seg));
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -312,7 +445,8 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->cpu = p->cpu;
+  runnable(np);
   release(&np->lock);
 
   return pid;
@@ -344,6 +478,8 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  munmapall(p, p->pagetable);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -353,10 +489,13 @@ exit(int status)
     }
   }
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   iput(p->cwd);
+  if(p->exe)
+    iput(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -384,9 +523,14 @@ int
 wait(uint64 addr)
 {
   struct proc *np;
-  int havekids, pid;
+  int havekids, pid, xstate;
   struct proc *p = myproc();
 
+  // the child is freed before its status is copied out, so
+  // check addr first: a bad one mustn't cost the status.
+  if(addr != 0 && uvmprefault(addr, sizeof(xstate), 1) < 0)
+    return -1;
+
   acquire(&wait_lock);
 
   for(;;){
@@ -401,15 +545,16 @@ wait(uint64 addr)
         if(np->state == ZOMBIE){
           // Found one.
           pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
+          xstate = np->xstate;
           freeproc(np);
           release(&np->lock);
           release(&wait_lock);
+          // copyout() may sleep, so it must not hold locks.
+          // addr was good above; if memory has run out since,
+          // the status is lost, but the child is reaped, so
+          // report its pid anyway.
+          if(addr != 0)
+            copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate));
           return pid;
         }
         release(&np->lock);
@@ -430,7 +575,8 @@ wait(uint64 addr)
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the next process from this CPU's run queue,
+//    or steal one from another CPU's if it is empty.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -439,28 +585,39 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&p->lock);
-    }
+    if((p = dequeue(id)) == 0 && (p = steal(id)) == 0)
+      continue;
+
+    // p is off the queues, and nothing but this CPU changes
+    // the state of a RUNNABLE process, but the CPU that made
+    // p RUNNABLE may still hold p->lock while it swtches away
+    // from p; wait for that here.
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = id;
+    c->proc = p;
+    kvmswitch(p);
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // Leave its kernel page table, which wait() may free.
+    kvmswitch(0);
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -497,11 +654,41 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runnable(p);
   sched();
   release(&p->lock);
 }
 
+// Start a kernel thread: a process that runs fn() in the
+// kernel, with no user memory, and never exits.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->context.ra = (uint64)kthreadret;
+  p->kfn = fn;
+  p->cpu = cpuid();
+  safestrcpy(p->name, name, sizeof(p->name));
+  runnable(p);
+  release(&p->lock);
+}
+
+// A kernel thread's first scheduling by scheduler()
+// will swtch here.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+  p->kfn();
+  panic("kthread returned");
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -529,28 +716,44 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *q = sqhash(chan);
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's sleep queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the sleep queue),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&q->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
+  p->sqprev = 0;
+  p->sqnext = q->head;
+  if(q->head)
+    q->head->sqprev = p;
+  q->head = p;
   p->chan = chan;
   p->state = SLEEPING;
+  release(&q->lock);
 
   sched();
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+  acquire(&q->lock);
+  if(p->sqprev)
+    p->sqprev->sqnext = p->sqnext;
+  else
+    q->head = p->sqnext;
+  if(p->sqnext)
+    p->sqnext->sqprev = p->sqprev;
+  release(&q->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
@@ -559,17 +762,22 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
+  struct sleepq *q = sqhash(chan);
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  acquire(&q->lock);
+  for(p = q->head; p; p = p->sqnext) {
+    // a woken process stays on the queue until it
+    // runs again, so p may be RUNNABLE or RUNNING.
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        runnable(p);
       }
       release(&p->lock);
     }
   }
+  release(&q->lock);
 }
 
 // Kill the process with the given pid.
@@ -586,7 +794,7 @@ kill(int pid)
       p->killed = 1;
       if(p->state == SLEEPING){
         // Wake process from sleep().
-        p->state = RUNNABLE;
+        runnable(p);
       }
       release(&p->lock);
       return 0;
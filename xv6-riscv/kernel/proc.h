@@ -24,6 +24,7 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  uint asidgen;               // ASID generation the TLB was flushed for
 };
 
 extern struct cpu cpus[NCPU];
@@ -80,6 +81,24 @@ struct trapframe {
   /* 280 */ uint64 t6;
 };
 
+// A loadable segment of the program a process runs, as
+// recorded by exec() for loadpage().
+struct seg {
+  uint64 va;      // user virtual address of the start, page-aligned
+  uint64 off;     // offset of the start in the executable
+  uint64 filesz;  // bytes of the segment in the executable
+};
+
+// A region of a file mapped by mmap(); see mmap.c.
+struct vma {
+  uint64 start;   // user virtual address, page-aligned
+  uint64 len;     // bytes, a multiple of PGSIZE; 0 if unused
+  int prot;       // PROT_READ, PROT_WRITE, PROT_EXEC
+  int flags;      // MAP_SHARED or MAP_PRIVATE
+  struct file *f; // the mapped file
+  uint64 off;     // offset of start in the file
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -92,6 +111,14 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p joins when RUNNABLE
+
+  // the run queue's lock must be held when using this:
+  struct proc *rqnext;         // Next process in the run queue
+
+  // the sleep queue's lock must be held when using these:
+  struct proc *sqnext;         // Next process in the sleep queue for chan
+  struct proc *sqprev;         // Previous process in the sleep queue
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -100,9 +127,22 @@ struct proc {
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
+  pagetable_t kpagetable;      // Kernel page table, mapping user memory too
+  uint asid;                   // Address-space ID of both page tables
+  uint asidgen;                // ... valid in this generation of ASIDs
+  int asidcpu;                 // CPU that last ran with the ASID
+  int kyield;                  // Preempted in the kernel; see swapout()
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct inode *exe;           // Executable, for loadpage()
+  struct seg seg[NSEG];        // Segments of the executable
+  int nseg;                    // Number of entries in seg[]
+  struct vma vma[NVMA];        // Mapped files
   char name[16];               // Process name (debugging)
+  int nsyscall;                // System calls made, for syscount()
+  void (*kfn)(void);           // A kernel thread's function
+  int logres;                  // Log blocks this FS op reserved
+  int logused;                 // and how many it has added
 };
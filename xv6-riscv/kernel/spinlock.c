@@ -8,12 +8,82 @@
 #include "proc.h"
 #include "defs.h"
 
+// lockstat() counts the acquires of the locks whose names
+// start with one of these, and they are recorded in locks[].
+// Other locks aren't counted, so that acquire() costs them
+// nothing extra.
+static char *statnames[] = { "bcache", "runq" };
+
+#define NLOCK 64
+
+static struct spinlock *locks[NLOCK];
+static struct spinlock lockslock; // protects locks[]
+
+void
+lockinit(void)
+{
+  initlock(&lockslock, "locks");
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
+  int i;
+
   lk->name = name;
   lk->locked = 0;
   lk->cpu = 0;
+  lk->stat = 0;
+  lk->n = 0;
+  lk->nts = 0;
+
+  for(i = 0; i < NELEM(statnames); i++)
+    if(strncmp(name, statnames[i], strlen(statnames[i])) == 0)
+      lk->stat = 1;
+  if(!lk->stat)
+    return;
+  acquire(&lockslock);
+  for(i = 0; i < NLOCK && locks[i] != 0; i++)
+    ;
+  if(i == NLOCK)
+    panic("initlock: too many counted locks");
+  locks[i] = lk;
+  release(&lockslock);
+}
+
+// Forget about a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  if(!lk->stat)
+    return;
+  acquire(&lockslock);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lockslock);
+}
+
+// Sum the acquire() and spin counts of all locks
+// whose name starts with prefix.
+void
+lockstat(char *prefix, uint64 *nacquire, uint64 *nspin)
+{
+  int len = strlen(prefix);
+
+  *nacquire = 0;
+  *nspin = 0;
+  acquire(&lockslock);
+  for(int i = 0; i < NLOCK; i++){
+    if(locks[i] && strncmp(locks[i]->name, prefix, len) == 0){
+      *nacquire += locks[i]->n;
+      *nspin += locks[i]->nts;
+    }
+  }
+  release(&lockslock);
 }
 
 // Acquire the lock.
@@ -29,8 +99,14 @@ acquire(struct spinlock *lk)
   //   a5 = 1
   //   s1 = &lk->locked
   //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  if(lk->stat){
+    __sync_fetch_and_add(&lk->n, 1);
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      __sync_fetch_and_add(&lk->nts, 1);
+  } else {
+    while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
+      ;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -5,5 +5,10 @@ struct spinlock {
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For lockstat(), if the lock is one it counts (stat):
+  int stat;
+  uint64 n;          // Number of acquire() calls.
+  uint64 nts;        // Number of spins waiting in acquire().
 };
 
@@ -9,3 +9,13 @@ struct stat {
   short nlink; // Number of links to file
   uint64 size; // Size of file in bytes
 };
+
+// Block I/O counts since boot, from iostat().
+struct iostat {
+  uint64 mapreads;   // bread()s of indirect blocks by bmap()
+  uint64 diskreads;  // blocks read from the disk
+  uint64 diskwrites; // blocks written to the disk
+  uint64 diskreqs;   // disk requests, each of one or more blocks
+  uint64 swapins;    // pages read from the swap area
+  uint64 swapouts;   // pages written to the swap area
+};
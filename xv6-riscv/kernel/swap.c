@@ -0,0 +1,297 @@
+// Swapping pages of user memory to disk.
+//
+// mkfs leaves a swap area on the disk after the file system
+// (sb.swapstart, sb.nswap blocks), cut into page-sized slots.
+// When kalloc() runs out of memory, kallocswap() calls
+// swapout(), which writes a page of some process to a free
+// slot, frees the page, and leaves the slot number in the
+// page's PTE, marked PTE_SWAP but not PTE_V. When the process
+// next touches the page, vmfault() calls swapin() to read it
+// back. fork() gives the child the parent's swapped PTEs too,
+// so a slot has a reference count, like a physical page.
+//
+// swapout() chooses a page with the clock algorithm: a hand
+// walks through the processes and their memory, and takes
+// the first page whose accessed bit (PTE_A, which the hardware
+// sets) is clear, clearing the bits it passes over, so that a
+// page survives as long as it is used once per trip of the
+// hand. Only pages below p->sz that no other process shares
+// are swapped; memory-mapped files and page-table pages stay in
+// memory, and a superpage is split into pages first. Splitting
+// takes a page-table page, and swapout() runs when none is
+// free, so it keeps a spare one (swap.spare) for that, and
+// takes another when the page it swaps out is freed.
+//
+// Only a process that isn't running, and isn't stopped in the
+// middle of kernel code (p->kyield) that may be holding one of
+// its PTEs, has its pages taken, under its p->lock; or else the
+// process calling swapout() itself, whose callers hold no PTE
+// of a page that could be swapped.
+//
+// swap.lock protects the slots' reference counts. swap.iolock
+// serializes swap I/O through swap.buf[], and the clock hand.
+
+#include "types.h"
+#include "riscv.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "stat.h"
+
+#define SLOTBLKS (PGSIZE/BSIZE)   // disk blocks in a slot
+
+extern struct proc proc[NPROC];
+
+struct {
+  struct spinlock lock;
+  uchar ref[MAXSWAP/SLOTBLKS];    // references to each slot
+  int nslot;
+  int next;                       // where slotalloc() looks first
+
+  struct sleeplock iolock;
+  struct buf buf[SLOTBLKS];       // a page of disk blocks
+  uint dev;
+  uint start;                     // first block of the swap area
+  pagetable_t spare;              // for victim() to split a superpage
+  int hand;                       // the clock hand: proc[] index
+  uint64 va;                      // ... and user address
+} swap;
+
+void
+swapinit(int dev, struct superblock *sb)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&swap.iolock, "swapio");
+  swap.dev = dev;
+  swap.start = sb->swapstart;
+  swap.nslot = sb->nswap / SLOTBLKS;
+  if(swap.nslot > MAXSWAP/SLOTBLKS)
+    swap.nslot = MAXSWAP/SLOTBLKS;
+  swap.spare = (pagetable_t)kalloc();
+}
+
+// Find a free slot and give it one reference.
+// Returns the slot, or -1 if swap is full.
+static int
+slotalloc(void)
+{
+  int i, s;
+
+  acquire(&swap.lock);
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.ref[s] == 0){
+      swap.ref[s] = 1;
+      swap.next = (s + 1) % swap.nslot;
+      release(&swap.lock);
+      return s;
+    }
+  }
+  release(&swap.lock);
+  return -1;
+}
+
+// Another PTE refers to slot, for fork().
+void
+swapdup(uint64 slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapdup");
+  if(swap.ref[slot] == 255)
+    panic("swapdup: too many references");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot.
+void
+swapfree(uint64 slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  swap.ref[slot]--;
+  release(&swap.lock);
+}
+
+// Read (write == 0) or write the slot's blocks from or to
+// swap.buf[]. Caller holds swap.iolock.
+static void
+swaprw(int slot, int write)
+{
+  struct buf *bs[SLOTBLKS];
+  int i;
+
+  for(i = 0; i < SLOTBLKS; i++){
+    swap.buf[i].dev = swap.dev;
+    swap.buf[i].blockno = swap.start + slot*SLOTBLKS + i;
+    bs[i] = &swap.buf[i];
+  }
+  virtio_disk_submit(bs, SLOTBLKS, write);
+  for(i = 0; i < SLOTBLKS; i++)
+    virtio_disk_wait(bs[i]);
+}
+
+// Move the clock hand through p's memory to a page to swap
+// out, and replace its PTE with one for slot. Returns the
+// page's physical address, or 0 if the hand reached p->sz.
+// Caller holds p->lock and swap.iolock.
+static uint64
+victim(struct proc *p, int slot)
+{
+  pte_t *pte;
+  uint64 pa;
+
+  while(swap.va < p->sz){
+    pte = walk(p->pagetable, swap.va, 0);
+    if(pte != 0 && (*pte & PTE_V) && (*pte & PTE_S)){
+      // split a superpage that hasn't been used lately, so
+      // that its pages can go one by one.
+      if((*pte & PTE_A) == 0 && krefcnt((void*)PTE2PA(*pte)) == 1 &&
+         swap.spare != 0){
+        uvmsplit(p->pagetable, swap.va, swap.spare);
+        swap.spare = 0;
+        continue;
+      }
+      *pte &= ~PTE_A;
+      pte = 0;
+    }
+    if(pte == 0){
+      swap.va = SUPERPGROUNDDOWN(swap.va) + SUPERPGSIZE;
+      continue;
+    }
+    swap.va += PGSIZE;
+    if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+      continue;
+    pa = PTE2PA(*pte);
+    if(krefcnt((void*)pa) != 1)
+      continue;
+    if(*pte & PTE_A){
+      // a second chance. the TLB may keep an entry that
+      // says the page was accessed, so the hardware may not
+      // set PTE_A again; then the page goes on the next trip.
+      *pte &= ~PTE_A;
+      continue;
+    }
+    *pte = SLOT2PTE(slot);
+    return pa;
+  }
+  return 0;
+}
+
+// Write a page of some process's memory to swap and free it.
+// Returns 1, or 0 if swap is full or no page could be found.
+int
+swapout(void)
+{
+  struct proc *p;
+  uint64 pa;
+  int i, slot;
+
+  acquiresleep(&swap.iolock);
+  if((slot = slotalloc()) < 0){
+    releasesleep(&swap.iolock);
+    return 0;
+  }
+
+  // twice around, since the first trip may only clear
+  // accessed bits.
+  pa = 0;
+  for(i = 0; i < 2*NPROC+1 && pa == 0; i++){
+    p = &proc[swap.hand];
+    acquire(&p->lock);
+    if(p == myproc() || p->state == SLEEPING ||
+       (p->state == RUNNABLE && !p->kyield)){
+      if((pa = victim(p, slot)) != 0){
+        // the process's TLB entries for the page must go:
+        // now if it is this one, or else when it next runs.
+        if(p == myproc())
+          uvmflush();
+        else
+          p->asidcpu = -1;
+      }
+    }
+    if(pa == 0){
+      swap.hand = (swap.hand + 1) % NPROC;
+      swap.va = 0;
+    }
+    release(&p->lock);
+  }
+  if(pa == 0){
+    swapfree(slot);
+    releasesleep(&swap.iolock);
+    return 0;
+  }
+
+  for(i = 0; i < SLOTBLKS; i++)
+    memmove(swap.buf[i].data, (char*)pa + i*BSIZE, BSIZE);
+  swaprw(slot, 1);
+  __sync_fetch_and_add(&iostat.swapouts, 1);
+  kfree((void*)pa);
+  if(swap.spare == 0)
+    swap.spare = (pagetable_t)kalloc();
+  releasesleep(&swap.iolock);
+  return 1;
+}
+
+// Read the swapped-out page at va back into pagetable, which
+// is the current process's. Returns the physical address of
+// the page, or 0 if memory ran out.
+uint64
+swapin(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 slot;
+  char *mem;
+  int i;
+
+  if((mem = kallocswap()) == 0)
+    return 0;
+
+  // the PTE stays as it is while this process sleeps:
+  // swapout() only changes valid ones.
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) || (*pte & PTE_SWAP) == 0)
+    panic("swapin");
+  slot = PTE2SLOT(*pte);
+
+  acquiresleep(&swap.iolock);
+  swaprw(slot, 0);
+  for(i = 0; i < SLOTBLKS; i++)
+    memmove(mem + i*BSIZE, swap.buf[i].data, BSIZE);
+  __sync_fetch_and_add(&iostat.swapins, 1);
+  releasesleep(&swap.iolock);
+
+  *pte = PA2PTE(mem) | PTE_W|PTE_X|PTE_R|PTE_U|PTE_V;
+  swapfree(slot);
+  return (uint64)mem;
+}
+
+// Allocate a page like kalloc(), but swap pages out to make
+// room if memory has run out. May sleep, so the caller must
+// hold no spinlocks, nor any PTE of a page of its own memory
+// that swapout() might take.
+void*
+kallocswap(void)
+{
+  void *mem;
+
+  while((mem = kalloc()) == 0)
+    if(swapout() == 0)
+      return 0;
+  return mem;
+}
+
+// Swap out pages until about n pages are free, for code that
+// must allocate memory while holding a spinlock.
+void
+swapreserve(int n)
+{
+  while(kfreepages() < n && swapout())
+    ;
+}
@@ -20,3 +20,10 @@
 #define SYS_link   19
 #define SYS_mkdir  20
 #define SYS_close  21
+#define SYS_lockstat 22
+#define SYS_fcntl  23
+#define SYS_syscount 24
+#define SYS_iostat 25
+#define SYS_fsync  26
+#define SYS_mmap   27
+#define SYS_munmap 28
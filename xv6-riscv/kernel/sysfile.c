@@ -52,6 +52,52 @@ fdalloc(struct file *f)
   return -1;
 }
 
+// Only the pipe buffer size commands, for now.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, n;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(f->type != FD_PIPE)
+    return -1;
+  return pipefcntl(f->pipe, cmd, n);
+}
+
+// copy the block I/O counts to the struct iostat
+// at the given user address.
+uint64
+sys_iostat(void)
+{
+  uint64 addr;
+
+  if(argaddr(0, &addr) < 0)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char*)&iostat, sizeof(iostat)) < 0)
+    return -1;
+  return 0;
+}
+
+// wait until the changes to fd's file are on the disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+  uint seq;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE && f->type != FD_DEVICE)
+    return -1;
+  ilock(f->ip);
+  seq = f->ip->tseq;
+  iunlock(f->ip);
+  log_force(seq);
+  return 0;
+}
+
 uint64
 sys_dup(void)
 {
@@ -125,7 +171,7 @@ sys_link(void)
   if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -149,6 +195,7 @@ sys_link(void)
     iunlockput(dp);
     goto bad;
   }
+  dcenter(dp, name, ip->inum);
   iunlockput(dp);
   iput(ip);
 
@@ -192,7 +239,7 @@ sys_unlink(void)
   if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -218,6 +265,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcremove(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -275,12 +323,27 @@ create(char *path, short type, short major, short minor)
       panic("create dots");
   }
 
+  // dirlink fails if dp is a hashed directory whose
+  // index is full.
   if(dirlink(dp, name, ip->inum) < 0)
-    panic("create: dirlink");
+    goto fail;
+  dcenter(dp, name, ip->inum);
 
   iunlockput(dp);
 
   return ip;
+
+fail:
+  // de-allocate ip.
+  if(type == T_DIR){
+    dp->nlink--;
+    iupdate(dp);
+  }
+  ip->nlink = 0;
+  iupdate(ip);
+  iunlockput(ip);
+  iunlockput(dp);
+  return 0;
 }
 
 uint64
@@ -295,7 +358,7 @@ sys_open(void)
   if((n = argstr(0, path, MAXPATH)) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -357,7 +420,7 @@ sys_mkdir(void)
   char path[MAXPATH];
   struct inode *ip;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -374,7 +437,7 @@ sys_mknod(void)
   char path[MAXPATH];
   int major, minor;
 
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -394,7 +457,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *p = myproc();
   
-  begin_op();
+  begin_op(MAXOPBLOCKS);
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -484,3 +547,27 @@ sys_pipe(void)
   }
   return 0;
 }
+
+// map a file into memory; see mmap.c.
+uint64
+sys_mmap(void)
+{
+  uint64 addr, len, off;
+  int prot, flags;
+  struct file *f;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argfd(4, 0, &f) < 0 || argaddr(5, &off) < 0)
+    return -1;
+  return mmap(addr, len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
@@ -95,3 +95,29 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// how many system calls this process has made,
+// including this one.
+uint64
+sys_syscount(void)
+{
+  return myproc()->nsyscall;
+}
+
+// report how many times the locks whose names start
+// with the given prefix were acquired, and how many
+// times acquire() spun waiting for them, as two
+// uint64s at the given user address.
+uint64
+sys_lockstat(void)
+{
+  char prefix[32];
+  uint64 addr, st[2];
+
+  if(argstr(0, prefix, sizeof(prefix)) < 0 || argaddr(1, &addr) < 0)
+    return -1;
+  lockstat(prefix, &st[0], &st[1]);
+  if(copyout(myproc()->pagetable, addr, (char *)st, sizeof(st)) < 0)
+    return -1;
+  return 0;
+}
@@ -16,6 +16,9 @@ void kernelvec();
 
 extern int devintr();
 
+// in usercopy.S
+extern char usercopy[], usercopyend[], ucopyfault[];
+
 void
 trapinit(void)
 {
@@ -67,6 +70,12 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), r_scause() == 15) != 0){
+    // page fault on lazily-allocated memory, on a
+    // copy-on-write page, or on a mapped file; the page
+    // is now mapped.
+    uvmflush();
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -118,8 +127,9 @@ usertrapret(void)
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
 
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // tell trampoline.S the user page table to switch to,
+  // with the ASID kvmswitch() gave the process.
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(SATP2ASID(r_satp()));
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
@@ -143,15 +153,34 @@ kerneltrap()
   if(intr_get() != 0)
     panic("kerneltrap: interrupts enabled");
 
-  if((which_dev = devintr()) == 0){
+  // a trap in ucopy or ucopystr comes with SSTATUS_SUM set.
+  // clear it while handling the trap: swtch() doesn't save
+  // sstatus, so a yield() would leave it set for whatever runs
+  // next on this CPU. w_sstatus(sstatus) below sets it again.
+  w_sstatus(sstatus & ~SSTATUS_SUM);
+
+  if((scause == 13 || scause == 15) &&
+     sepc >= (uint64)usercopy && sepc < (uint64)usercopyend){
+    // a page fault in copyout() or copyin(): map the page
+    // and retry, or make the copy fail.
+    if(vmfault(myproc()->pagetable, r_stval(), scause == 15) != 0)
+      uvmflush();
+    else
+      sepc = (uint64)ucopyfault;
+  } else if((which_dev = devintr()) == 0){
     printf("scause %p\n", scause);
     printf("sepc=%p stval=%p\n", r_sepc(), r_stval());
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
+  // give up the CPU if this is a timer interrupt. the
+  // interrupted code may hold PTEs of the process's memory,
+  // so swapout() must leave it alone meanwhile.
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING){
+    myproc()->kyield = 1;
     yield();
+    myproc()->kyield = 0;
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
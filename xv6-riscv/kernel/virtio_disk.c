@@ -3,10 +3,17 @@
 // uses qemu's mmio interface to virtio.
 // qemu presents a "legacy" virtio interface.
 //
+// requests are asynchronous: virtio_disk_submit() posts a batch
+// of requests and notifies the device once, and
+// virtio_disk_wait() waits for a buffer's request to finish.
+// a run of consecutive blocks becomes a single request, with
+// one data descriptor per buffer.
+//
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
 
 #include "types.h"
+#include "stat.h"
 #include "riscv.h"
 #include "defs.h"
 #include "param.h"
@@ -20,6 +27,9 @@
 // the address of virtio mmio register r.
 #define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
 
+// max number of blocks in one request.
+#define MAXSEG 8
+
 static struct disk {
   // the virtio driver and device mostly communicate through a set of
   // structures in RAM. pages[] allocates that memory. pages[] is a
@@ -61,7 +71,7 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;  // first buf of the request; the rest follow b->dnext
     char status;
   } info[NUM];
 
@@ -184,12 +194,12 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a disk transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -200,27 +210,17 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// post a request for the k consecutive blocks bs[0..k-1],
+// using the k+2 descriptors in idx[]. the device doesn't
+// look at it until the next notify().
+static void
+post(struct buf **bs, int k, int write, int *idx)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+  // a descriptor for type/reserved/sector, descriptors for the
+  // data, and one for a 1-byte status result.
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -230,31 +230,36 @@ virtio_disk_rw(struct buf *b, int write)
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
+  buf0->sector = bs[0]->blockno * (BSIZE / 512);
 
   disk.desc[idx[0]].addr = (uint64) buf0;
   disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(int i = 0; i < k; i++){
+    struct virtq_desc *d = &disk.desc[idx[i+1]];
+    d->addr = (uint64) bs[i]->data;
+    d->len = BSIZE;
+    if(write)
+      d->flags = 0; // device reads b->data
+    else
+      d->flags = VRING_DESC_F_WRITE; // device writes b->data
+    d->flags |= VRING_DESC_F_NEXT;
+    d->next = idx[i+2];
+
+    // record struct buf for virtio_disk_intr().
+    bs[i]->disk = 1;
+    bs[i]->dnext = i+1 < k ? bs[i+1] : 0;
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[k+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[k+1]].len = 1;
+  disk.desc[idx[k+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[k+1]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.info[idx[0]].b = bs[0];
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -263,22 +268,76 @@ virtio_disk_rw(struct buf *b, int write)
 
   // tell the device another avail ring entry is available.
   disk.avail->idx += 1; // not % NUM ...
+}
 
+// tell the device to look at the avail ring.
+static void
+notify(void)
+{
   __sync_synchronize();
-
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// Start reading (write == 0) or writing the n locked buffers
+// in bs[], and return without waiting for the disk. Adjacent
+// entries of bs[] that hold consecutive blocks are merged into
+// a single request. The caller must keep the buffers locked
+// until virtio_disk_wait() says they are done.
+void
+virtio_disk_submit(struct buf **bs, int n, int write)
+{
+  int idx[MAXSEG+2];
+  int i, k, posted = 0;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i += k){
+    for(k = 1; k < MAXSEG && i+k < n; k++){
+      if(bs[i+k]->dev != bs[i]->dev || bs[i+k]->blockno != bs[i]->blockno + k)
+        break;
+    }
+
+    while(alloc_descs(idx, k+2) != 0){
+      // let the device start on what we have posted,
+      // so that it will eventually free descriptors.
+      if(posted){
+        notify();
+        posted = 0;
+      }
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+    post(bs+i, k, write, idx);
+    posted = 1;
+    iostat.diskreqs++;
   }
+  if(write)
+    iostat.diskwrites += n;
+  else
+    iostat.diskreads += n;
+  if(posted)
+    notify();
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+  release(&disk.vdisk_lock);
+}
 
+// Wait for virtio_disk_intr() to say b's request has finished.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
+  while(b->disk == 1) {
+    sleep(b, &disk.vdisk_lock);
+  }
   release(&disk.vdisk_lock);
 }
 
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_submit(&b, 1, write);
+  virtio_disk_wait(b);
+}
+
 void
 virtio_disk_intr()
 {
@@ -304,9 +363,15 @@ virtio_disk_intr()
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    struct buf *b, *nb;
+    for(b = disk.info[id].b; b; b = nb){
+      nb = b->dnext;
+      b->dnext = 0;
+      b->disk = 0;   // disk is done with buf
+      wakeup(b);
+    }
+    disk.info[id].b = 0;
+    free_chain(id);
 
     disk.used_idx += 1;
   }
@@ -3,9 +3,15 @@
 #include "memlayout.h"
 #include "elf.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 #include "fs.h"
 
+// superfault() maps no superpage unless at least this many
+// pages of memory are free.
+#define SUPERLOW (4*SUPERPGSIZE/PGSIZE)
+
 /*
  * the kernel's page table.
  */
@@ -15,7 +21,33 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// Address-space IDs.
+//
+// A process's user and kernel page tables are tagged in satp
+// with the process's ASID, so that the TLB can hold the entries
+// of several processes at once, and neither traps nor context
+// switches need flush it. The two page tables agree wherever
+// both map an address (see kvmcreate()), so they can share an
+// ASID. The kernel's own mappings are global (PTE_G); its page
+// table, which has nothing else, has ASID 0.
+//
+// ASIDs are handed out in generations. When one runs out, a
+// new one starts, every process's ASID is stale, and each hart
+// flushes its whole TLB before it uses an ASID of the new
+// generation. A process's page table only changes while it
+// runs, and that hart flushes the ASID (uvmflush()); another
+// hart may still hold old entries, so it flushes the ASID when
+// the process next runs there.
+struct {
+  struct spinlock lock;
+  uint gen;               // current generation
+  uint next;              // next ASID to hand out in it
+} asids;
+
+static uint asidmax;      // largest ASID the harts have, or 0
+
 // Make a direct-map page table for the kernel.
+// mappages() maps the large regions with superpages.
 pagetable_t
 kvmmake(void)
 {
@@ -54,6 +86,9 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  initlock(&asids.lock, "asids");
+  asids.gen = 1;
+  asids.next = 1;
 }
 
 // Switch h/w page table register to the kernel's page table,
@@ -61,8 +96,119 @@ kvminit(void)
 void
 kvminithart()
 {
+  // the hart keeps only the ASID bits it implements.
+  w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(0xffff));
+  asidmax = SATP2ASID(r_satp());
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
+  mycpu()->asidgen = 0;
+}
+
+// Make a kernel page table for a process: the kernel's, but
+// with the first gigabyte of address space taken from the
+// process's user page table, which holds the process's memory
+// below USERTOP and the kernel's devices above it (see
+// uvmcreate()). The kernel can then reach user memory with
+// loads and stores; see copyout(). Only the top-level page is
+// the process's own, since the kernel's other top-level PTEs
+// never change after kvmmake().
+// Returns 0 if out of memory.
+pagetable_t
+kvmcreate(pagetable_t pagetable)
+{
+  pagetable_t kpgtbl;
+
+  if((kpgtbl = (pagetable_t) kalloc()) == 0)
+    return 0;
+  memmove(kpgtbl, kernel_pagetable, PGSIZE);
+  kpgtbl[0] = pagetable[0];
+  return kpgtbl;
+}
+
+// Point a process's kernel page table at its new user page
+// table, for exec(), which is running on it.
+void
+kvmuser(pagetable_t kpgtbl, pagetable_t pagetable)
+{
+  kpgtbl[0] = pagetable[0];
+  uvmflush();
+}
+
+// Switch h/w page table register to p's kernel page table,
+// giving p an ASID if it has none in this generation, or to
+// the kernel's own if p is 0.
+void
+kvmswitch(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  uint gen;
+
+  if(p == 0){
+    // only global mappings, which every TLB entry of
+    // every ASID agrees with.
+    w_satp(MAKE_SATP(kernel_pagetable));
+    return;
+  }
+
+  if(asidmax == 0){
+    // no ASIDs: every process has 0, and must flush.
+    w_satp(MAKE_SATP(p->kpagetable));
+    sfence_vma();
+    return;
+  }
+
+  acquire(&asids.lock);
+  if(p->asidgen != asids.gen){
+    if(asids.next > asidmax){
+      asids.gen++;
+      asids.next = 1;
+    }
+    p->asid = asids.next++;
+    p->asidgen = asids.gen;
+    p->asidcpu = -1;
+  }
+  gen = asids.gen;
+  release(&asids.lock);
+
+  w_satp(MAKE_SATP(p->kpagetable) | SATP_ASID(p->asid));
+  if(c->asidgen != gen){
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(p->asidcpu != cpuid()){
+    sfence_vma_asid(p->asid);
+  }
+  p->asidcpu = cpuid();
+}
+
+// Flush this hart's TLB entries for the current process, after
+// a change to its page table.
+void
+uvmflush(void)
+{
+  sfence_vma_asid(SATP2ASID(r_satp()));
+}
+
+// Like walk(), but stop at the PTE at the given level.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int stop, int alloc)
+{
+  if(va >= MAXVA)
+    panic("walk");
+
+  for(int level = 2; level > stop; level--) {
+    pte_t *pte = &pagetable[PX(level, va)];
+    if(*pte & PTE_V) {
+      if(*pte & PTE_S)
+        return pte;
+      pagetable = (pagetable_t)PTE2PA(*pte);
+    } else {
+      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
+        return 0;
+      memset(pagetable, 0, PGSIZE);
+      *pte = PA2PTE(pagetable) | PTE_V;
+    }
+  }
+  return &pagetable[PX(stop, va)];
 }
 
 // Return the address of the PTE in page table pagetable
@@ -77,24 +223,14 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+//
+// A level-1 PTE may instead be a leaf that maps a whole
+// 2MB superpage; it has PTE_S set. If va lies in one,
+// walk() returns that PTE, and LEAF2PA() finds va's page.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
-  if(va >= MAXVA)
-    panic("walk");
-
-  for(int level = 2; level > 0; level--) {
-    pte_t *pte = &pagetable[PX(level, va)];
-    if(*pte & PTE_V) {
-      pagetable = (pagetable_t)PTE2PA(*pte);
-    } else {
-      if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
-        return 0;
-      memset(pagetable, 0, PGSIZE);
-      *pte = PA2PTE(pagetable) | PTE_V;
-    }
-  }
-  return &pagetable[PX(0, va)];
+  return walklevel(pagetable, va, 0, alloc);
 }
 
 // Look up a virtual address, return the physical address,
@@ -116,23 +252,26 @@ walkaddr(pagetable_t pagetable, uint64 va)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  pa = LEAF2PA(*pte, va);
   return pa;
 }
 
-// add a mapping to the kernel page table.
-// only used when booting.
+// add a mapping to the kernel page table, in every
+// address space. only used when booting.
 // does not flush TLB or enable paging.
 void
 kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 {
-  if(mappages(kpgtbl, va, sz, pa, perm) != 0)
+  if(mappages(kpgtbl, va, sz, pa, perm | PTE_G) != 0)
     panic("kvmmap");
 }
 
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
+// be page-aligned. Where va and pa are both superpage-aligned
+// and a whole superpage remains to map, map a superpage, unless
+// some of its range already has a level-0 page-table page.
+// Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
@@ -146,6 +285,19 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
+    if(a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      if((pte = walklevel(pagetable, a, 1, 1)) == 0)
+        return -1;
+      if((*pte & PTE_V) == 0){
+        *pte = PA2PTE(pa) | perm | PTE_S | PTE_V;
+        if(last - a == SUPERPGSIZE - PGSIZE)
+          break;
+        a += SUPERPGSIZE;
+        pa += SUPERPGSIZE;
+        continue;
+      }
+    }
     if((pte = walk(pagetable, a, 1)) == 0)
       return -1;
     if(*pte & PTE_V)
@@ -160,8 +312,10 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
+// page-aligned. Pages that were never mapped (see vmfault())
+// are skipped, and guard pages forgotten. Optionally free
+// the physical memory, and the swap slots of swapped-out pages.
+// A superpage must be removed whole; see uvmdemote().
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
@@ -173,9 +327,22 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
+    if((*pte & PTE_V) == 0){
+      if(do_free && (*pte & PTE_SWAP))
+        swapfree(PTE2SLOT(*pte));
+      *pte = 0;
+      continue;
+    }
+    if(*pte & PTE_S){
+      if(a % SUPERPGSIZE != 0 || a + SUPERPGSIZE > va + npages*PGSIZE)
+        panic("uvmunmap: part of a superpage");
+      if(do_free)
+        ksuperfree((void*)PTE2PA(*pte));
+      *pte = 0;
+      a += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -187,15 +354,29 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 }
 
 // create an empty user page table.
+// its first gigabyte of address space shares the kernel's
+// mappings of the devices above USERTOP, so that the process's
+// kernel page table can share it (see kvmcreate()). they have
+// no PTE_U, so the process itself can't use them.
 // returns 0 if out of memory.
 pagetable_t
 uvmcreate()
 {
-  pagetable_t pagetable;
+  pagetable_t pagetable, l1, kl1;
+  int i;
+
   pagetable = (pagetable_t) kalloc();
   if(pagetable == 0)
     return 0;
   memset(pagetable, 0, PGSIZE);
+  if((l1 = (pagetable_t) kalloc()) == 0){
+    kfree(pagetable);
+    return 0;
+  }
+  kl1 = (pagetable_t)PTE2PA(kernel_pagetable[0]);
+  for(i = 0; i < 512; i++)
+    l1[i] = i < PX(1, USERTOP) ? 0 : kl1[i];
+  pagetable[0] = PA2PTE(l1) | PTE_V;
   return pagetable;
 }
 
@@ -243,6 +424,46 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
+// Replace the superpage mapping that holds va, if there is
+// one, with page mappings of the same memory, so that part of
+// it can be unmapped or copied on write.
+// Returns 0 on success, -1 if out of memory.
+int
+uvmdemote(pagetable_t pagetable, uint64 va)
+{
+  pagetable_t l0;
+  pte_t *pte;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_S) == 0)
+    return 0;
+  if((l0 = (pagetable_t)kalloc()) == 0)
+    return -1;
+  uvmsplit(pagetable, va, l0);
+  return 0;
+}
+
+// Replace the superpage mapping that holds va with page
+// mappings in l0, a page-table page the caller allocated:
+// swapout() keeps one ready, since it must split superpages
+// when no memory is free.
+void
+uvmsplit(pagetable_t pagetable, uint64 va, pagetable_t l0)
+{
+  pte_t *pte;
+  uint64 pa;
+  int i, flags;
+
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_S) == 0)
+    panic("uvmsplit");
+  pa = PTE2PA(*pte);
+  flags = PTE_FLAGS(*pte) & ~PTE_S;
+  for(i = 0; i < 512; i++)
+    l0[i] = PA2PTE(pa + i*PGSIZE) | flags;
+  *pte = PA2PTE(l0) | PTE_V;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -286,48 +507,261 @@ freewalk(pagetable_t pagetable)
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
+  pagetable_t l1;
+  int i;
+
   if(sz > 0)
     uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  // the device mappings are the kernel's.
+  l1 = (pagetable_t)PTE2PA(pagetable[0]);
+  for(i = PX(1, USERTOP); i < 512; i++)
+    l1[i] = 0;
   freewalk(pagetable);
 }
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Copies only the page table: parent and child
+// share the physical pages, with writable pages
+// turned into read-only copy-on-write pages in
+// both. cowfault() copies a page when either
+// one writes it. Pages the parent never touched
+// stay unmapped in the child too, and pages it has
+// swapped out are swapped out in both.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  return uvmcopyrange(old, new, 0, sz, 0);
+}
+
+// Like uvmcopy(), for the len bytes from page-aligned va.
+// If share is set, writable pages stay writable, and
+// writes by either process are seen by both.
+int
+uvmcopyrange(pagetable_t old, pagetable_t new, uint64 va, uint64 len, int share)
+{
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
-  for(i = 0; i < sz; i += PGSIZE){
+  for(i = va; i < va + len; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;
+    if((*pte & PTE_V) == 0){
+      if(*pte & (PTE_GUARD|PTE_SWAP)){
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        if(*pte & PTE_SWAP)
+          swapdup(PTE2SLOT(*pte));
+        *npte = *pte;
+      }
+      continue;
+    }
+    if((*pte & PTE_W) && !share)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    if(*pte & PTE_S){
+      // the child shares the whole superpage.
+      pa = PTE2PA(*pte);
+      flags = PTE_FLAGS(*pte) & ~PTE_S;
+      if(mappages(new, i, SUPERPGSIZE, pa, flags) != 0)
+        goto err;
+      ksuperdup((void*)pa);
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kdup((void*)pa);
   }
   return 0;
 
  err:
-  uvmunmap(new, 0, i / PGSIZE, 1);
+  uvmunmap(new, va, (i - va) / PGSIZE, 1);
   return -1;
 }
 
-// mark a PTE invalid for user access.
+// Handle a write to the copy-on-write page at va by giving
+// pagetable its own writable copy. If no one else refers to
+// the page any more, just make it writable.
+// Returns the physical address of the now-writable page,
+// or 0 if va is not a copy-on-write page or memory ran out.
+uint64
+cowfault(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0)
+    return 0;
+  if((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & PTE_COW) == 0)
+    return 0;
+  if(*pte & PTE_S){
+    // copy only the page written.
+    if(uvmdemote(pagetable, va) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return pa;
+  }
+
+  // the extra reference keeps swapout() from taking the
+  // page, and so changing *pte, while kallocswap() sleeps.
+  kdup((void*)pa);
+  if((mem = kallocswap()) == 0){
+    kfree((void*)pa);
+    return 0;
+  }
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  kfree((void*)pa);
+  return (uint64)mem;
+}
+
+// If the superpage-aligned block of user memory that holds va
+// has none of the program's file data, and none of it is mapped
+// yet, map it all with one zeroed superpage, so that a large heap
+// takes fewer TLB entries and page-table pages. Not when memory
+// is short, though: swapout() would only have to split the
+// superpage again.
+// Returns the physical address of va's page, or 0.
+static uint64
+superfault(struct proc *p, uint64 va)
+{
+  uint64 base = SUPERPGROUNDDOWN(va);
+  struct seg *sg;
+  char *mem;
+
+  if(base + SUPERPGSIZE > p->sz)
+    return 0;
+  if(kfreepages() < SUPERLOW)
+    return 0;
+  for(sg = p->seg; sg < &p->seg[p->nseg]; sg++)
+    if(base < sg->va + sg->filesz && sg->va < base + SUPERPGSIZE)
+      return 0;
+  if(walk(p->pagetable, base, 0) != 0)
+    return 0;
+
+  if((mem = ksuperalloc()) == 0)
+    return 0;
+  memset(mem, 0, SUPERPGSIZE);
+  if(mappages(p->pagetable, base, SUPERPGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    ksuperfree(mem);
+    return 0;
+  }
+  return (uint64)mem + (va - base);
+}
+
+// Handle a page fault by the current process at user virtual
+// address va. If va is in the process's memory but was never
+// touched, allocate and map a page: zeroed if sbrk() grew the
+// process lazily, or read in from the executable if the page
+// holds part of the program (see exec()); see superfault() for
+// when it maps a superpage instead. If the page was swapped
+// out, read it back in (see swapin()). Above p->sz, va may
+// be in a memory-mapped file; see mmapfault(). Reading a file
+// or swap may sleep, so callers of copyin() and copyout() must
+// not hold spinlocks.
+// If the fault was a write to a copy-on-write page, give the
+// process its own copy.
+// Returns the physical address of the page, or 0 if va is
+// not valid for the access or memory ran out.
+uint64
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 pa;
+  char *mem;
+
+  if(va >= USERTOP)
+    return 0;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(pagetable, va, 0);
+  if(pte != 0 && (*pte & PTE_GUARD) != 0 && (*pte & PTE_V) == 0)
+    return 0;
+  if(pte != 0 && (*pte & PTE_SWAP) != 0 && (*pte & PTE_V) == 0)
+    return swapin(pagetable, va);
+  if(pte != 0 && (*pte & PTE_V) != 0){
+    if(write && (*pte & PTE_COW))
+      return cowfault(pagetable, va);
+    if(va >= p->sz)
+      return mmapfault(p, va, write);
+    return 0;
+  }
+  if(va >= p->sz)
+    return mmapfault(p, va, write);
+  if(pagetable == p->pagetable && (pa = superfault(p, va)) != 0)
+    return pa;
+
+  if((mem = kallocswap()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  if(loadpage(p, va, mem) < 0){
+    kfree(mem);
+    return 0;
+  }
+  // a page-table page may be needed too.
+  while(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    if(swapout() == 0){
+      kfree(mem);
+      return 0;
+    }
+  }
+  return (uint64)mem;
+}
+
+// Fault in the current process's pages that hold [va, va+n),
+// for writing if write is set. fileread() and filewrite() call
+// this before readi() and writei() take inode and buffer locks,
+// since a fault may have to read a file (see loadpage() and
+// mmapfault()); afterwards, copyout() and copyin() on the range
+// fault only to swap a page in or to copy it on write.
+// Returns 0, or -1 if some page can't be mapped.
+int
+uvmprefault(uint64 va, uint64 n, int write)
+{
+  struct proc *p = myproc();
+  int faulted = 0, r = 0;
+  pte_t *pte;
+  uint64 a;
+
+  if(n == 0)
+    return 0;
+  if(va >= USERTOP || n > USERTOP - va)
+    return -1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte != 0 && (*pte & PTE_V) && (*pte & PTE_U) &&
+       (!write || (*pte & PTE_W)))
+      continue;
+    if(vmfault(p->pagetable, a, write) == 0){
+      r = -1;
+      break;
+    }
+    faulted = 1;
+  }
+  if(faulted)
+    uvmflush();
+  return r;
+}
+
+// unmap a page, and keep vmfault() from mapping it again.
 // used by exec for the user stack guard page.
 void
 uvmclear(pagetable_t pagetable, uint64 va)
@@ -335,24 +769,55 @@ uvmclear(pagetable_t pagetable, uint64 va)
   pte_t *pte;
   
   pte = walk(pagetable, va, 0);
-  if(pte == 0)
+  if(pte == 0 || (*pte & PTE_V) == 0)
     panic("uvmclear");
-  *pte &= ~PTE_U;
+  kfree((void*)PTE2PA(*pte));
+  *pte = PTE_GUARD;
+}
+
+// Can copyout() and friends use loads and stores on user
+// addresses in pagetable? Only if it is the current process's,
+// whose kernel page table, the one in use, maps it.
+static int
+direct(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  return p != 0 && pagetable == p->pagetable;
 }
 
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
+// In the current process's page table, copyout(), copyin() and
+// copyinstr() copy directly, with faults handled by kerneltrap()
+// (see usercopy.S); in any other, they translate page by page.
 // Return 0 on success, -1 on error.
 int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+
+  if(direct(pagetable)){
+    if(len > USERTOP || dstva > USERTOP - len)
+      return -1;
+    return ucopy((char *)dstva, src, len);
+  }
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(va0 >= MAXVA)
+      return -1;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_W) == 0){
+      // not allocated yet, or copy-on-write.
+      if((pa0 = vmfault(pagetable, va0, 1)) == 0)
+        return -1;
+    } else if((*pte & PTE_U) == 0){
       return -1;
+    } else {
+      pa0 = LEAF2PA(*pte, va0);
+    }
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -373,10 +838,16 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
 
+  if(direct(pagetable)){
+    if(len > USERTOP || srcva > USERTOP - len)
+      return -1;
+    return ucopy(dst, (char *)srcva, len);
+  }
+
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > len)
@@ -400,10 +871,18 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   uint64 n, va0, pa0;
   int got_null = 0;
 
+  if(direct(pagetable)){
+    if(srcva >= USERTOP)
+      return -1;
+    if(max > USERTOP - srcva)
+      max = USERTOP - srcva;
+    return ucopystr(dst, (char *)srcva, max);
+  }
+
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
     pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    if(pa0 == 0 && (pa0 = vmfault(pagetable, va0, 0)) == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
     if(n > max)
@@ -19,10 +19,12 @@
 
 // Disk layout:
 // [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// followed by nswap blocks of swap.
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE+1;  // header and log blocks; mkfs -l sets it
+int nswap = SWAPSIZE;  // swap blocks; mkfs -s sets it
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +42,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum, struct dirent *ents, int n);
 void die(const char *);
 
 // convert to intel byte order
@@ -69,16 +72,36 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
+  static struct dirent ents[NINODES];
+  int nents;
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  while(argc > 2 && argv[1][0] == '-'){
+    if(strcmp(argv[1], "-l") == 0)
+      nlog = atoi(argv[2]);
+    else if(strcmp(argv[1], "-s") == 0)
+      nswap = atoi(argv[2]);
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] [-s nswap] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < 2*MAXOPBLOCKS+1 || nlog > MAXLOG+1){
+    fprintf(stderr, "mkfs: the log must have %d to %d blocks\n",
+            2*MAXOPBLOCKS+1, MAXLOG+1);
+    exit(1);
+  }
+  if(nswap < 0 || nswap > MAXSWAP || nswap % (4096/BSIZE) != 0){
+    fprintf(stderr, "mkfs: the swap area must be a multiple of %d blocks, up to %d\n",
+            4096/BSIZE, MAXSWAP);
     exit(1);
   }
 
@@ -101,13 +124,15 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(nswap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d swap %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE, nswap);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
+  for(i = 0; i < FSSIZE + nswap; i++)
     wsect(i, zeroes);
 
   memset(buf, 0, sizeof(buf));
@@ -117,16 +142,7 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
-
+  nents = 0;
   for(i = 2; i < argc; i++){
     // get rid of "user/"
     char *shortname;
@@ -149,10 +165,11 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nents < NINODES);
+    bzero(&ents[nents], sizeof(ents[nents]));
+    ents[nents].inum = xshort(inum);
+    strncpy(ents[nents].name, shortname, DIRSIZ);
+    nents++;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,12 +177,7 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, ents, nents);
 
   balloc(freeblock);
 
@@ -249,6 +261,95 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+static int
+hashcmp(const void *a, const void *b)
+{
+  uint ha = dirhash(((struct dirent*)a)->name);
+  uint hb = dirhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Write the entries of root directory inum: ".", "..", then
+// ents. If they do not fit in one block, make it a hashed
+// directory (see struct dxhead), with its leaves filled to
+// LEAFFILL entries so the kernel can add some without
+// splitting them.
+#define LEAFFILL (DPB*3/4)
+
+void
+wdir(uint inum, struct dirent *ents, int n)
+{
+  struct dirent de[DPB];
+  struct dxhead *hd;
+  struct dxent *e;
+  struct dinode din;
+  uint off;
+  int i, j, nleaf, start[DXMAX+1];
+
+  bzero(de, sizeof(de));
+  de[0].inum = xshort(inum);
+  strcpy(de[0].name, ".");
+  de[1].inum = xshort(inum);
+  strcpy(de[1].name, "..");
+
+  if(2 + n <= DPB){
+    iappend(inum, de, 2*sizeof(de[0]));
+    iappend(inum, ents, n*sizeof(ents[0]));
+
+    // fix size of root inode dir
+    rinode(inum, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(inum, &din);
+    return;
+  }
+
+  // sort by hash, and cut leaves only where the hash changes.
+  qsort(ents, n, sizeof(ents[0]), hashcmp);
+  hd = (struct dxhead*)&de[2];
+  e = (struct dxent*)(hd + 1);
+  nleaf = 0;
+  for(i = 0; i < n; i = j){
+    assert(nleaf < DXMAX);
+    start[nleaf] = i;
+    e[nleaf].hash = xint(nleaf == 0 ? 0 : dirhash(ents[i].name));
+    e[nleaf].block = xint(nleaf + 1);
+    nleaf++;
+    for(j = i + 1; j < n; j++){
+      if(dirhash(ents[j].name) != dirhash(ents[j-1].name) && j - i >= LEAFFILL)
+        break;
+      assert(j - i < DPB);
+    }
+  }
+  start[nleaf] = n;
+  hd->magic = DXMAGIC;
+  hd->n = xint(nleaf);
+  iappend(inum, de, sizeof(de));
+
+  for(i = 0; i < nleaf; i++){
+    bzero(de, sizeof(de));
+    memmove(de, &ents[start[i]], (start[i+1] - start[i]) * sizeof(de[0]));
+    iappend(inum, de, sizeof(de));
+  }
+}
+
+// Return entry i of indirect block addr, allocating
+// a block for it if there is none.
+uint
+mapent(uint addr, uint i)
+{
+  uint indirect[NINDIRECT];
+
+  rsect(addr, (char*)indirect);
+  if(indirect[i] == 0){
+    indirect[i] = xint(freeblock++);
+    wsect(addr, (char*)indirect);
+  }
+  return xint(indirect[i]);
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,7 +357,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -270,16 +370,17 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      x = mapent(xint(din.addrs[NDIRECT]), fbn - NDIRECT);
+    } else {
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = fbn - NDIRECT - NINDIRECT;
+      x = mapent(mapent(xint(din.addrs[NDIRECT+1]), x / NINDIRECT), x % NINDIRECT);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,1122 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fs.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+
+//
+// Performance benchmarks. bench without arguments runs them all
+// and bench <name> runs <name>. Each benchmark runs in its own
+// process and prints its measurements; times are in clock ticks
+// (see uptime()). Compare the numbers across kernels, or across
+// make CPUS=1, CPUS=3 and CPUS=8.
+//
+
+// allocation throughput with several processes allocating
+// and freeing physical pages at once, via sbrk().
+void
+kallocbench(char *s)
+{
+  enum { ROUNDS = 400, NPAGE = 64 };
+  int nproc, i, pid, xstatus, t0, t1;
+
+  for(nproc = 1; nproc <= 8; nproc *= 2){
+    t0 = uptime();
+    for(i = 0; i < nproc; i++){
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        for(int r = 0; r < ROUNDS; r++){
+          char *a = sbrk(NPAGE*PGSIZE);
+          if(a == (char*)0xffffffffffffffffL){
+            printf("%s: sbrk failed\n", s);
+            exit(1);
+          }
+          for(int j = 0; j < NPAGE; j++)
+            a[j*PGSIZE] = r;
+          sbrk(-NPAGE*PGSIZE);
+        }
+        exit(0);
+      }
+    }
+    for(i = 0; i < nproc; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t1 = uptime();
+    printf("%s: %d procs, %d pages each, %d ticks\n",
+           s, nproc, ROUNDS*NPAGE, t1 - t0);
+  }
+}
+
+char buf[BSIZE];
+
+// several processes reading different files at once, all
+// from the buffer cache. reports how often the buffer cache
+// locks were acquired and how often acquire() had to spin.
+void
+bcachebench(char *s)
+{
+  enum { NCHILD = 4, NBLK = 4, ROUNDS = 200 };
+  char name[4];
+  uint64 st0[2], st1[2];
+  int i, j, fd, pid, xstatus, t0, t1;
+
+  name[0] = 'b';
+  name[2] = 0;
+  for(i = 0; i < NCHILD; i++){
+    name[1] = '0' + i;
+    fd = open(name, O_CREATE | O_RDWR);
+    if(fd < 0){
+      printf("%s: create %s failed\n", s, name);
+      exit(1);
+    }
+    memset(buf, i, sizeof(buf));
+    for(j = 0; j < NBLK; j++){
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf("%s: write %s failed\n", s, name);
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+
+  if(lockstat("bcache", st0) < 0){
+    printf("%s: lockstat failed\n", s);
+    exit(1);
+  }
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    name[1] = '0' + i;
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(int r = 0; r < ROUNDS; r++){
+        fd = open(name, O_RDONLY);
+        if(fd < 0){
+          printf("%s: open %s failed\n", s, name);
+          exit(1);
+        }
+        for(j = 0; j < NBLK; j++){
+          if(read(fd, buf, sizeof(buf)) != sizeof(buf)){
+            printf("%s: read %s failed\n", s, name);
+            exit(1);
+          }
+        }
+        close(fd);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  t1 = uptime();
+  lockstat("bcache", st1);
+  printf("%s: %d procs, %d ticks, %l acquires, %l spins\n", s, NCHILD,
+         t1 - t0, st1[0] - st0[0], st1[1] - st0[1]);
+
+  for(i = 0; i < NCHILD; i++){
+    name[1] = '0' + i;
+    unlink(name);
+  }
+}
+
+// fork() latency as the parent grows: N forks of a child
+// that exits at once, then N of a child that execs echo.
+void
+forkbench(char *s)
+{
+  enum { N = 50 };
+  char *argv[] = { "echo", 0 };
+  int mb, i, pid, t0, t1, t2;
+  char *base = sbrk(0);
+
+  for(mb = 0; mb <= 16; mb = (mb ? mb*4 : 1)){
+    if(sbrk(base + mb*1024*1024 - sbrk(0)) == (char*)0xffffffffffffffffL){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    // touch every page so that fork has something to copy.
+    for(char *p = base; p < sbrk(0); p += PGSIZE)
+      *p = 1;
+
+    t0 = uptime();
+    for(i = 0; i < N; i++){
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0)
+        exit(0);
+      wait(0);
+    }
+    t1 = uptime();
+    for(i = 0; i < N; i++){
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        close(1);
+        exec("echo", argv);
+        exit(1);
+      }
+      wait(0);
+    }
+    t2 = uptime();
+    printf("%s: %d MB parent, %d fork+exit %d ticks, %d fork+exec %d ticks\n",
+           s, mb, N, t1 - t0, N, t2 - t1);
+  }
+}
+
+// exec() latency of a small and a large program. each child
+// closes its output, so the program exits after printing
+// (nothing) in a usage message or an echo.
+void
+execbench(char *s)
+{
+  enum { N = 50 };
+  char *progs[] = { "echo", "usertests", 0 };
+  char *argv[] = { 0, "-x", 0 };
+  int i, pid, t0, t1;
+  char **prog;
+
+  for(prog = progs; *prog; prog++){
+    argv[0] = *prog;
+    t0 = uptime();
+    for(i = 0; i < N; i++){
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        close(1);
+        exec(*prog, argv);
+        exit(1);
+      }
+      wait(0);
+    }
+    t1 = uptime();
+    printf("%s: %d execs of %s, %d ticks\n", s, N, *prog, t1 - t0);
+  }
+}
+
+// disk write throughput: create a file a few blocks per
+// write() and so per log commit, then delete it.
+void
+writebench(char *s)
+{
+  enum { NBLK = 200, PERWRITE = 4 };
+  static char wbuf[PERWRITE*BSIZE];
+  int fd, i, t0, t1;
+
+  t0 = uptime();
+  fd = open("wbench", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i += PERWRITE){
+    if(write(fd, wbuf, sizeof(wbuf)) != sizeof(wbuf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  t1 = uptime();
+  unlink("wbench");
+  printf("%s: %d blocks, %d per write, %d ticks\n", s, NBLK, PERWRITE, t1 - t0);
+}
+
+// sequential read throughput: read a file much larger than
+// the buffer cache from start to end, with small and large
+// read()s.
+void
+readbench(char *s)
+{
+  enum { NBLK = 256 };
+  static char rbuf[8*BSIZE];
+  int sizes[] = { BSIZE/2, 8*BSIZE, 0 };
+  int fd, i, n, tot, t0, t1;
+
+  fd = open("rbench", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NBLK; i++){
+    if(write(fd, rbuf, BSIZE) != BSIZE){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  for(i = 0; sizes[i]; i++){
+    fd = open("rbench", O_RDONLY);
+    if(fd < 0){
+      printf("%s: open failed\n", s);
+      exit(1);
+    }
+    tot = 0;
+    t0 = uptime();
+    while((n = read(fd, rbuf, sizes[i])) > 0)
+      tot += n;
+    t1 = uptime();
+    close(fd);
+    if(tot != NBLK*BSIZE){
+      printf("%s: read %d bytes, expected %d\n", s, tot, NBLK*BSIZE);
+      exit(1);
+    }
+    printf("%s: %d blocks, %d-byte reads, %d ticks\n", s, NBLK, sizes[i], t1 - t0);
+  }
+  unlink("rbench");
+}
+
+// look at every byte of a file, by read()ing it into a
+// buffer and through a MAP_PRIVATE mapping, which saves
+// the copy to the buffer.
+void
+mmapbench(char *s)
+{
+  enum { NBLK = 256, SZ = NBLK*BSIZE };
+  static char mbuf[8*BSIZE];
+  int fd, i, n, sum0, sum1, t0, t1, t2;
+  char *p;
+
+  fd = open("mbench", O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(mbuf); i++)
+    mbuf[i] = i;
+  for(i = 0; i < NBLK; i += 8){
+    if(write(fd, mbuf, sizeof(mbuf)) != sizeof(mbuf)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  fd = open("mbench", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  sum0 = 0;
+  t0 = uptime();
+  while((n = read(fd, mbuf, sizeof(mbuf))) > 0)
+    for(i = 0; i < n; i++)
+      sum0 += mbuf[i];
+  t1 = uptime();
+  p = mmap(0, SZ, PROT_READ, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  sum1 = 0;
+  for(i = 0; i < SZ; i++)
+    sum1 += p[i];
+  t2 = uptime();
+  munmap(p, SZ);
+  close(fd);
+  if(sum0 != sum1){
+    printf("%s: read and mmap disagree\n", s);
+    exit(1);
+  }
+  printf("%s: %d blocks, read %d ticks, mmap %d ticks\n", s, NBLK, t1 - t0, t2 - t1);
+  unlink("mbench");
+}
+
+// walk a 64MB heap a page at a time, so that every access
+// needs a different 4KB translation: first through the
+// superpages sbrk() memory gets, then, in a child whose
+// writes have split each superpage, through 4KB pages.
+void
+tlbbench(char *s)
+{
+  enum { SZ = 64*1024*1024, PASS = 20 };
+  char *p, *end;
+  uint64 i;
+  int pass, pid, sum, t0, t1, xst;
+
+  p = sbrk(SZ);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  end = p + SZ;
+  for(i = 0; i < SZ; i += PGSIZE)
+    p[i] = 1;
+
+  sum = 0;
+  t0 = uptime();
+  for(pass = 0; pass < PASS; pass++)
+    for(i = 0; i < SZ; i += PGSIZE)
+      sum += p[i];
+  t1 = uptime();
+  printf("%s: %d passes over %d pages, superpages %d ticks\n",
+         s, PASS, SZ/PGSIZE, t1 - t0);
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // a write to each copy-on-write superpage splits it.
+    for(i = SUPERPGROUNDUP((uint64)p); i + SUPERPGSIZE <= (uint64)end; i += SUPERPGSIZE)
+      *(char*)i = 1;
+    sum = 0;
+    t0 = uptime();
+    for(pass = 0; pass < PASS; pass++)
+      for(i = 0; i < SZ; i += PGSIZE)
+        sum += p[i];
+    t1 = uptime();
+    printf("%s: %d passes over %d pages, 4KB pages %d ticks\n",
+           s, PASS, SZ/PGSIZE, t1 - t0);
+    exit(sum != PASS*(SZ/PGSIZE));
+  }
+  wait(&xst);
+  if(xst != 0 || sum != PASS*(SZ/PGSIZE)){
+    printf("%s: wrong sum\n", s);
+    exit(1);
+  }
+  sbrk(-SZ);
+}
+
+// sequential passes writing a page at a time over a heap
+// that fits in memory, then over one bigger than memory,
+// which the kernel must swap through the disk.
+void
+swapbench(char *s)
+{
+  enum { PASS = 3 };
+  static int sizes[] = { 32*1024*1024, 136*1024*1024 };
+  struct iostat st0, st1;
+  char *p;
+  uint64 i;
+  int k, pass, pid, xst, t0, t1;
+
+  for(k = 0; k < sizeof(sizes)/sizeof(sizes[0]); k++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      p = sbrk(sizes[k]);
+      if(p == (char*)-1){
+        printf("%s: sbrk failed\n", s);
+        exit(1);
+      }
+      iostat(&st0);
+      t0 = uptime();
+      for(pass = 0; pass < PASS; pass++)
+        for(i = 0; i < sizes[k]; i += PGSIZE)
+          p[i] = pass;
+      t1 = uptime();
+      iostat(&st1);
+      printf("%s: %d passes over %d pages, %d ticks, %d swapped out, %d in\n",
+             s, PASS, sizes[k]/PGSIZE, t1 - t0,
+             (int)(st1.swapouts - st0.swapouts), (int)(st1.swapins - st0.swapins));
+      exit(0);
+    }
+    wait(&xst);
+    if(xst != 0){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+}
+
+// small appends to a file, each its own transaction, with
+// and without an fsync() after each: commits happen in the
+// background unless someone waits for them.
+void
+fsyncbench(char *s)
+{
+  enum { N = 200, SZ = 64 };
+  static char fbuf[SZ];
+  struct iostat st0, st1;
+  int fd, i, sync, t0, t1;
+
+  for(sync = 0; sync < 2; sync++){
+    fd = open("fsbench", O_CREATE | O_WRONLY | O_TRUNC);
+    if(fd < 0){
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    iostat(&st0);
+    t0 = uptime();
+    for(i = 0; i < N; i++){
+      if(write(fd, fbuf, SZ) != SZ || (sync && fsync(fd) != 0)){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+    t1 = uptime();
+    iostat(&st1);
+    close(fd);
+    printf("%s: %d %d-byte writes%s, %d ticks, %d blocks written\n", s, N, SZ,
+           sync ? " + fsync" : "", t1 - t0, (int)(st1.diskwrites - st0.diskwrites));
+  }
+  unlink("fsbench");
+}
+
+// write and then read a file of several megabytes, and count
+// the indirect blocks bmap() reads to map it, per megabyte.
+void
+bmapbench(char *s)
+{
+  enum { MB = 4, CHUNK = 8*BSIZE };
+  static char bbuf[CHUNK];
+  struct iostat st0, st1, st2;
+  int fd, i, t0, t1, t2;
+
+  fd = open("bmbench", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  iostat(&st0);
+  t0 = uptime();
+  for(i = 0; i < MB*1024*1024/CHUNK; i++){
+    if(write(fd, bbuf, CHUNK) != CHUNK){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  iostat(&st1);
+  t1 = uptime();
+
+  fd = open("bmbench", O_RDONLY);
+  while((i = read(fd, bbuf, CHUNK)) > 0)
+    ;
+  close(fd);
+  iostat(&st2);
+  t2 = uptime();
+  if(i < 0){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  unlink("bmbench");
+
+  printf("%s: %d MB, write %d ticks %d map reads/MB, read %d ticks %d map reads/MB\n",
+         s, MB, t1 - t0, (int)(st1.mapreads - st0.mapreads) / MB,
+         t2 - t1, (int)(st2.mapreads - st1.mapreads) / MB);
+}
+
+// write two files a block at a time, alternating between
+// them, then read each back, and count the blocks per disk
+// request: readahead can only batch blocks that are next to
+// each other on the disk.
+void
+allocbench(char *s)
+{
+  enum { NBLK = 512 };
+  static char abuf[BSIZE];
+  char *names[] = { "abench0", "abench1" };
+  struct iostat st0, st1;
+  int fd[2], i, j, t0, t1;
+
+  for(j = 0; j < 2; j++){
+    if((fd[j] = open(names[j], O_CREATE | O_WRONLY)) < 0){
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+  }
+  t0 = uptime();
+  for(i = 0; i < NBLK; i++){
+    for(j = 0; j < 2; j++){
+      if(write(fd[j], abuf, BSIZE) != BSIZE){
+        printf("%s: write failed\n", s);
+        exit(1);
+      }
+    }
+  }
+  t1 = uptime();
+  close(fd[0]);
+  close(fd[1]);
+  printf("%s: 2 x %d blocks, write %d ticks\n", s, NBLK, t1 - t0);
+
+  for(j = 0; j < 2; j++){
+    fd[j] = open(names[j], O_RDONLY);
+    iostat(&st0);
+    t0 = uptime();
+    while((i = read(fd[j], abuf, BSIZE)) > 0)
+      ;
+    t1 = uptime();
+    iostat(&st1);
+    close(fd[j]);
+    unlink(names[j]);
+    if(st1.diskreqs == st0.diskreqs){
+      printf("%s: %s read %d ticks, all cached\n", s, names[j], t1 - t0);
+      continue;
+    }
+    printf("%s: %s read %d ticks, %d blocks in %d disk requests\n", s, names[j],
+           t1 - t0, (int)(st1.diskreads - st0.diskreads), (int)(st1.diskreqs - st0.diskreqs));
+  }
+}
+
+// add, look up and remove the entries of directories of
+// growing size, all links to one file since inodes are few;
+// with a linear directory each operation costs time
+// proportional to the directory's size.
+void
+dirbench(char *s)
+{
+  int sizes[] = { 64, 256, 1024, 0 };
+  int i, j, fd, t0, t1, t2, t3;
+  char name[16];
+
+  if((fd = open("dbfile", O_CREATE | O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; sizes[i]; i++){
+    if(mkdir("dbench") != 0){
+      printf("%s: mkdir failed\n", s);
+      exit(1);
+    }
+    name[0] = 'd'; name[1] = 'b'; name[2] = 'e'; name[3] = 'n';
+    name[4] = 'c'; name[5] = 'h'; name[6] = '/'; name[11] = '\0';
+    t0 = uptime();
+    for(j = 0; j < sizes[i]; j++){
+      name[7] = 'a' + (j >> 12) % 16; name[8] = 'a' + (j >> 8) % 16;
+      name[9] = 'a' + (j >> 4) % 16; name[10] = 'a' + j % 16;
+      if(link("dbfile", name) != 0){
+        printf("%s: link %s failed\n", s, name);
+        exit(1);
+      }
+    }
+    t1 = uptime();
+    for(j = 0; j < sizes[i]; j++){
+      name[7] = 'a' + (j >> 12) % 16; name[8] = 'a' + (j >> 8) % 16;
+      name[9] = 'a' + (j >> 4) % 16; name[10] = 'a' + j % 16;
+      if((fd = open(name, O_RDONLY)) < 0){
+        printf("%s: open %s failed\n", s, name);
+        exit(1);
+      }
+      close(fd);
+    }
+    t2 = uptime();
+    for(j = 0; j < sizes[i]; j++){
+      name[7] = 'a' + (j >> 12) % 16; name[8] = 'a' + (j >> 8) % 16;
+      name[9] = 'a' + (j >> 4) % 16; name[10] = 'a' + j % 16;
+      if(unlink(name) != 0){
+        printf("%s: unlink %s failed\n", s, name);
+        exit(1);
+      }
+    }
+    t3 = uptime();
+    unlink("dbench");
+    printf("%s: %d entries, link %d, open %d, unlink %d ticks\n",
+           s, sizes[i], t1 - t0, t2 - t1, t3 - t2);
+  }
+  unlink("dbfile");
+}
+
+// open a file four directories down, and a name that does not
+// exist beside it, over and over.
+void
+pathbench(char *s)
+{
+  enum { N = 2000 };
+  char *dirs[] = { "pb", "pb/a", "pb/a/b", "pb/a/b/c", 0 };
+  int i, fd, t0, t1, t2;
+
+  for(i = 0; dirs[i]; i++){
+    if(mkdir(dirs[i]) != 0){
+      printf("%s: mkdir %s failed\n", s, dirs[i]);
+      exit(1);
+    }
+  }
+  if((fd = open("pb/a/b/c/f", O_CREATE | O_WRONLY)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  t0 = uptime();
+  for(i = 0; i < N; i++){
+    if((fd = open("pb/a/b/c/f", O_RDONLY)) < 0){
+      printf("%s: open failed\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+  t1 = uptime();
+  for(i = 0; i < N; i++){
+    if(open("pb/a/b/c/nofile", O_RDONLY) >= 0){
+      printf("%s: open nofile succeeded\n", s);
+      exit(1);
+    }
+  }
+  t2 = uptime();
+  printf("%s: %d opens, found %d ticks, not found %d ticks\n", s, N, t1 - t0, t2 - t1);
+
+  unlink("pb/a/b/c/f");
+  for(i = 3; i >= 0; i--)
+    unlink(dirs[i]);
+}
+
+// pipe throughput: stream bytes through a pipe in
+// different write sizes, with the default buffer limit
+// and with a large one.
+void
+pipebench(char *s)
+{
+  enum { NBYTES = 4*1024*1024 };
+  static char pbuf[8192];
+  int sizes[] = { 1, 512, 8192, 0 };
+  int limits[] = { 0, 64*1024, -1 };
+  int fds[2], pid, i, l, n, r, tot, limit, t0, t1;
+
+  for(l = 0; limits[l] >= 0; l++){
+    for(i = 0; sizes[i]; i++){
+      if(pipe(fds) < 0){
+        printf("%s: pipe failed\n", s);
+        exit(1);
+      }
+      if(limits[l] && fcntl(fds[1], F_SETPIPE_SZ, limits[l]) < 0){
+        printf("%s: fcntl failed\n", s);
+        exit(1);
+      }
+      limit = fcntl(fds[0], F_GETPIPE_SZ, 0);
+      // single-byte writes are slow; send less.
+      n = sizes[i] == 1 ? NBYTES/64 : NBYTES;
+      t0 = uptime();
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        close(fds[0]);
+        for(tot = 0; tot < n; tot += sizes[i]){
+          if(write(fds[1], pbuf, sizes[i]) != sizes[i])
+            exit(1);
+        }
+        exit(0);
+      }
+      close(fds[1]);
+      tot = 0;
+      while((r = read(fds[0], pbuf, sizeof(pbuf))) > 0)
+        tot += r;
+      wait(0);
+      t1 = uptime();
+      close(fds[0]);
+      if(tot != n){
+        printf("%s: read %d bytes, expected %d\n", s, tot, n);
+        exit(1);
+      }
+      printf("%s: limit %d, %d bytes in %d-byte writes, %d ticks\n",
+             s, limit, n, sizes[i], t1 - t0);
+    }
+  }
+}
+
+// system calls per line of output to a file: a write()
+// per character, as printf used to do, and then fprintf()
+// to an unbuffered, a line buffered and a fully buffered
+// FILE.
+void
+stdiobench(char *s)
+{
+  enum { NLINE = 200 };
+  char *names[] = { "write per char", "unbuffered", "line buffered", "fully buffered" };
+  int modes[] = { -1, _IONBF, _IOLBF, _IOFBF };
+  char *line = "the quick brown fox jumps over the lazy dog\n";
+  int m, i, n0, n1, t0, t1;
+  FILE *f;
+
+  for(m = 0; m < 4; m++){
+    if((f = fopen("sbench", "w")) == 0){
+      printf("%s: fopen failed\n", s);
+      exit(1);
+    }
+    if(modes[m] >= 0)
+      setvbuf(f, modes[m]);
+    t0 = uptime();
+    n0 = syscount();
+    for(i = 0; i < NLINE; i++){
+      if(modes[m] < 0){
+        for(char *p = line; *p; p++){
+          fputc(*p, f);
+          fflush(f);
+        }
+      } else {
+        fprintf(f, "%s", line);
+      }
+    }
+    fflush(f);
+    n1 = syscount();
+    t1 = uptime();
+    fclose(f);
+    printf("%s: %s, %d lines, %d system calls, %d ticks\n",
+           s, names[m], NLINE, n1 - n0 - 1, t1 - t0);
+  }
+  unlink("sbench");
+}
+
+// The K&R first-fit allocator that umalloc.c used to be,
+// for mallocbench to compare against.
+
+typedef long Align;
+
+union header {
+  struct {
+    union header *ptr;
+    uint size;
+  } s;
+  Align x;
+};
+
+typedef union header Header;
+
+static Header krbase;
+static Header *krfreep;
+
+static void
+krfree(void *ap)
+{
+  Header *bp, *p;
+
+  bp = (Header*)ap - 1;
+  for(p = krfreep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
+    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
+      break;
+  if(bp + bp->s.size == p->s.ptr){
+    bp->s.size += p->s.ptr->s.size;
+    bp->s.ptr = p->s.ptr->s.ptr;
+  } else
+    bp->s.ptr = p->s.ptr;
+  if(p + p->s.size == bp){
+    p->s.size += bp->s.size;
+    p->s.ptr = bp->s.ptr;
+  } else
+    p->s.ptr = bp;
+  krfreep = p;
+}
+
+static Header*
+krmorecore(uint nu)
+{
+  char *p;
+  Header *hp;
+
+  if(nu < 4096)
+    nu = 4096;
+  p = sbrk(nu * sizeof(Header));
+  if(p == (char*)-1)
+    return 0;
+  hp = (Header*)p;
+  hp->s.size = nu;
+  krfree((void*)(hp + 1));
+  return krfreep;
+}
+
+static void*
+krmalloc(uint nbytes)
+{
+  Header *p, *prevp;
+  uint nunits;
+
+  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
+  if((prevp = krfreep) == 0){
+    krbase.s.ptr = krfreep = prevp = &krbase;
+    krbase.s.size = 0;
+  }
+  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
+    if(p->s.size >= nunits){
+      if(p->s.size == nunits)
+        prevp->s.ptr = p->s.ptr;
+      else {
+        p->s.size -= nunits;
+        p += p->s.size;
+        p->s.size = nunits;
+      }
+      krfreep = prevp;
+      return (void*)(p + 1);
+    }
+    if(p == krfreep)
+      if((p = krmorecore(nunits)) == 0)
+        return 0;
+  }
+}
+
+static uint rnd = 1;
+
+static uint
+rand(void)
+{
+  rnd = rnd * 1103515245 + 12345;
+  return rnd >> 8;
+}
+
+// malloc() and free() throughput, against the old K&R
+// allocator: random small sizes with random frees among
+// NLIVE live blocks, which fragments a first-fit heap,
+// and then a mix with large blocks.
+void
+mallocbench(char *s)
+{
+  enum { NLIVE = 1000, ROUNDS = 50000 };
+  static void *live[NLIVE];
+  void *(*allocs[])(uint) = { krmalloc, malloc };
+  void (*frees[])(void*) = { krfree, free };
+  char *names[] = { "K&R", "size-class" };
+  int a, i, r, large, t0, t1;
+  uint n;
+
+  for(large = 0; large < 2; large++){
+    for(a = 0; a < 2; a++){
+      rnd = 1;
+      t0 = uptime();
+      for(r = 0; r < ROUNDS; r++){
+        i = rand() % NLIVE;
+        if(live[i]){
+          frees[a](live[i]);
+          live[i] = 0;
+        } else {
+          n = 8 + rand() % 250;
+          if(large && rand() % 16 == 0)
+            n = 4096 + rand() % 16384;
+          if((live[i] = allocs[a](n)) == 0){
+            printf("%s: %s malloc failed\n", s, names[a]);
+            exit(1);
+          }
+          *(char*)live[i] = r;
+        }
+      }
+      for(i = 0; i < NLIVE; i++){
+        if(live[i])
+          frees[a](live[i]);
+        live[i] = 0;
+      }
+      t1 = uptime();
+      printf("%s: %s, %s sizes, %d ticks\n", s, names[a],
+             large ? "mixed" : "small", t1 - t0);
+    }
+  }
+}
+
+// bounce a byte ROUNDS times between the two ends of a pair
+// of pipes; each round trip is two sleeps and two wakeups.
+static void
+pingpong(char *s, int rounds)
+{
+  int p1[2], p2[2], pid;
+  char c = 0;
+
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(int r = 0; r < rounds; r++){
+      if(read(p1[0], &c, 1) != 1 || write(p2[1], &c, 1) != 1)
+        exit(1);
+    }
+    exit(0);
+  }
+  for(int r = 0; r < rounds; r++){
+    if(write(p1[1], &c, 1) != 1 || read(p2[0], &c, 1) != 1){
+      printf("%s: pingpong failed\n", s);
+      exit(1);
+    }
+  }
+  wait(0);
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+}
+
+// system call round trips: getpid() alone, then with a walk
+// over NPAGE pages of memory after each call, which shows
+// what refilling the TLB after every trap costs, if the
+// kernel flushes it.
+void
+syscallbench(char *s)
+{
+  enum { N = 100000, NPAGE = 32 };
+  static char mem[NPAGE*PGSIZE];
+  int i, j, sum, t0, t1, t2;
+
+  for(j = 0; j < NPAGE; j++)
+    mem[j*PGSIZE] = 1;
+  sum = 0;
+  t0 = uptime();
+  for(i = 0; i < N; i++)
+    getpid();
+  t1 = uptime();
+  for(i = 0; i < N; i++){
+    getpid();
+    for(j = 0; j < NPAGE; j++)
+      sum += mem[j*PGSIZE];
+  }
+  t2 = uptime();
+  if(sum != N*NPAGE){
+    printf("%s: wrong sum\n", s);
+    exit(1);
+  }
+  printf("%s: %d getpid() %d ticks, with %d pages touched each %d ticks\n",
+         s, N, t1 - t0, NPAGE, t2 - t1);
+}
+
+// context-switch throughput: 1 to 8 pairs of processes
+// ping-ponging over pipes at once. then scheduling latency:
+// one pair ping-ponging while NHOG processes spin, so that
+// every wakeup has to wait its turn in a run queue.
+void
+schedbench(char *s)
+{
+  enum { ROUNDS = 1000, NHOG = 8 };
+  int npair, i, pid, xstatus, t0, t1;
+  int hogs[NHOG];
+  uint64 st0[2], st1[2];
+
+  for(npair = 1; npair <= 8; npair *= 2){
+    if(lockstat("runq", st0) < 0){
+      printf("%s: lockstat failed\n", s);
+      exit(1);
+    }
+    t0 = uptime();
+    for(i = 0; i < npair; i++){
+      pid = fork();
+      if(pid < 0){
+        printf("%s: fork failed\n", s);
+        exit(1);
+      }
+      if(pid == 0){
+        pingpong(s, ROUNDS);
+        exit(0);
+      }
+    }
+    for(i = 0; i < npair; i++){
+      wait(&xstatus);
+      if(xstatus != 0)
+        exit(1);
+    }
+    t1 = uptime();
+    lockstat("runq", st1);
+    printf("%s: %d pairs, %d round trips each, %d ticks, %l spins\n",
+           s, npair, ROUNDS, t1 - t0, st1[1] - st0[1]);
+  }
+
+  for(i = 0; i < NHOG; i++){
+    hogs[i] = fork();
+    if(hogs[i] < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(hogs[i] == 0)
+      for(;;)
+        ;
+  }
+  t0 = uptime();
+  pingpong(s, ROUNDS / 10);
+  t1 = uptime();
+  for(i = 0; i < NHOG; i++){
+    kill(hogs[i]);
+    wait(0);
+  }
+  printf("%s: %d round trips beside %d spinning procs, %d ticks\n",
+         s, ROUNDS / 10, NHOG, t1 - t0);
+}
+
+// run each benchmark in its own process.
+// returns 1 if the child's exit() indicates success.
+int
+run(void f(char *), char *s) {
+  int pid;
+  int xstatus;
+
+  printf("bench %s:\n", s);
+  if((pid = fork()) < 0) {
+    printf("runbench: fork error\n");
+    exit(1);
+  }
+  if(pid == 0) {
+    f(s);
+    exit(0);
+  } else {
+    wait(&xstatus);
+    if(xstatus != 0)
+      printf("bench %s: FAILED\n", s);
+    return xstatus == 0;
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *justone = 0;
+
+  if(argc == 2 && argv[1][0] != '-'){
+    justone = argv[1];
+  } else if(argc > 1){
+    printf("Usage: bench [benchname]\n");
+    exit(1);
+  }
+
+  struct bench {
+    void (*f)(char *);
+    char *s;
+  } benches[] = {
+    {kallocbench, "kalloc"},
+    {bcachebench, "bcache"},
+    {forkbench, "fork"},
+    {execbench, "exec"},
+    {writebench, "write"},
+    {fsyncbench, "fsync"},
+    {readbench, "read"},
+    {mmapbench, "mmap"},
+    {tlbbench, "tlb"},
+    {swapbench, "swap"},
+    {bmapbench, "bmap"},
+    {allocbench, "alloc"},
+    {dirbench, "dir"},
+    {pathbench, "path"},
+    {pipebench, "pipe"},
+    {stdiobench, "stdio"},
+    {mallocbench, "malloc"},
+    {schedbench, "sched"},
+    {syscallbench, "syscall"},
+    { 0, 0},
+  };
+
+  int fail = 0;
+  for (struct bench *b = benches; b->s != 0; b++) {
+    if((justone == 0) || strcmp(b->s, justone) == 0) {
+      if(!run(b->f, b->s))
+        fail = 1;
+    }
+  }
+  exit(fail);
+}
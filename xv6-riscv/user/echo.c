@@ -8,11 +8,11 @@ main(int argc, char *argv[])
   int i;
 
   for(i = 1; i < argc; i++){
-    write(1, argv[i], strlen(argv[i]));
+    fputs(argv[i], stdout);
     if(i + 1 < argc){
-      write(1, " ", 1);
+      putc(' ', stdout);
     } else {
-      write(1, "\n", 1);
+      putc('\n', stdout);
     }
   }
   exit(0);
@@ -6,14 +6,27 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// vfprintf() formats into a small buffer and hands the
+// result to the FILE with fwrite(), so that even on an
+// unbuffered stream a short message takes one write().
+struct out {
+  FILE *f;
+  int n;
+  char buf[128];
+};
+
 static void
-putc(int fd, char c)
+outc(struct out *o, char c)
 {
-  write(fd, &c, 1);
+  if(o->n == sizeof(o->buf)){
+    fwrite(o->buf, o->n, o->f);
+    o->n = 0;
+  }
+  o->buf[o->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct out *o, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,25 +48,28 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    outc(o, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct out *o, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  outc(o, '0');
+  outc(o, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    outc(o, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
-// Print to the given fd. Only understands %d, %x, %p, %s.
+// Print to the given stream. Only understands %d, %x, %p, %s.
 void
-vprintf(int fd, const char *fmt, va_list ap)
+vfprintf(FILE *f, const char *fmt, va_list ap)
 {
+  struct out o;
   char *s;
   int c, i, state;
 
+  o.f = f;
+  o.n = 0;
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -61,46 +77,48 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        outc(&o, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(&o, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(&o, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(&o, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(&o, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          outc(&o, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        outc(&o, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        outc(&o, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        outc(&o, '%');
+        outc(&o, c);
       }
       state = 0;
     }
   }
+  if(o.n > 0)
+    fwrite(o.buf, o.n, f);
 }
 
 void
-fprintf(int fd, const char *fmt, ...)
+fprintf(FILE *f, const char *fmt, ...)
 {
   va_list ap;
 
   va_start(ap, fmt);
-  vprintf(fd, fmt, ap);
+  vfprintf(f, fmt, ap);
 }
 
 void
@@ -109,5 +127,5 @@ printf(const char *fmt, ...)
   va_list ap;
 
   va_start(ap, fmt);
-  vprintf(1, fmt, ap);
+  vfprintf(stdout, fmt, ap);
 }
@@ -0,0 +1,289 @@
+//
+// Buffered I/O on file descriptors.
+//
+// A FILE collects output in a buffer and hands it to write()
+// when the buffer fills (_IOFBF), at each newline (_IOLBF), or
+// at the end of each call (_IONBF), and fills its buffer with
+// one read() to satisfy many getc()s. stdout is line buffered
+// when it is the console and fully buffered otherwise; stderr
+// is unbuffered. fork(), exec() and exit() flush every FILE,
+// so buffered output is neither lost nor written twice.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define FOPEN_MAX 8   // streams besides stdin, stdout and stderr
+#define NFILES (3+FOPEN_MAX)
+
+#define F_READ  0x1   // opened for reading
+#define F_WRITE 0x2   // opened for writing
+#define F_EOF   0x4   // read() returned 0
+#define F_ERR   0x8   // read() or write() failed
+
+struct FILE {
+  int fd;          // -1 if not in use
+  int flags;
+  int mode;        // _IONBF, _IOLBF, _IOFBF, or -1 until first use
+  int r;           // next byte to return from buf
+  int n;           // bytes in buf
+  char buf[BUFSIZ];
+};
+
+static FILE files[NFILES] = {
+  { 0, F_READ, -1 },
+  { 1, F_WRITE, -1 },
+  { 2, F_WRITE, _IONBF },
+  [3 ... NFILES-1] = { -1 },
+};
+
+FILE *stdin = &files[0];
+FILE *stdout = &files[1];
+FILE *stderr = &files[2];
+
+// Buffer console streams by line and everything else fully.
+static void
+setmode(FILE *f)
+{
+  struct stat st;
+
+  if(fstat(f->fd, &st) == 0 && st.type == T_DEVICE)
+    f->mode = _IOLBF;
+  else
+    f->mode = _IOFBF;
+}
+
+int
+fflush(FILE *f)
+{
+  int i, m, r;
+
+  if(f == 0){
+    r = 0;
+    for(i = 0; i < NFILES; i++)
+      if(files[i].fd >= 0 && fflush(&files[i]) < 0)
+        r = EOF;
+    return r;
+  }
+  if((f->flags & F_WRITE) == 0)
+    return 0;
+  for(i = 0; i < f->n; i += m){
+    if((m = write(f->fd, f->buf + i, f->n - i)) <= 0){
+      f->flags |= F_ERR;
+      f->n = 0;
+      return EOF;
+    }
+  }
+  f->n = 0;
+  return 0;
+}
+
+// Add c to f's buffer, flushing when full or at a newline
+// if line buffered. Unbuffered streams are flushed by the
+// caller, once per call, by done().
+static void
+put(int c, FILE *f)
+{
+  f->buf[f->n++] = c;
+  if((c == '\n' && f->mode == _IOLBF) || f->n == BUFSIZ)
+    fflush(f);
+}
+
+static int
+startput(FILE *f)
+{
+  if((f->flags & F_WRITE) == 0)
+    return -1;
+  if(f->mode < 0)
+    setmode(f);
+  return 0;
+}
+
+static int
+done(FILE *f)
+{
+  if(f->mode == _IONBF && fflush(f) < 0)
+    return EOF;
+  return f->flags & F_ERR ? EOF : 0;
+}
+
+int
+fputc(int c, FILE *f)
+{
+  if(startput(f) < 0)
+    return EOF;
+  put(c, f);
+  if(done(f) < 0)
+    return EOF;
+  return c & 0xff;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+  if(startput(f) < 0)
+    return EOF;
+  while(*s)
+    put(*s++, f);
+  return done(f);
+}
+
+int
+fwrite(const void *p, int n, FILE *f)
+{
+  const char *s = p;
+  int i;
+
+  if(startput(f) < 0)
+    return 0;
+  for(i = 0; i < n; i++)
+    put(s[i], f);
+  if(done(f) < 0)
+    return 0;
+  return n;
+}
+
+int
+fgetc(FILE *f)
+{
+  if((f->flags & F_READ) == 0)
+    return EOF;
+  if(f->r == f->n){
+    if(f->flags & (F_EOF | F_ERR))
+      return EOF;
+    // an interactive program's prompt should appear
+    // before it waits for input.
+    if(f == stdin)
+      fflush(stdout);
+    f->r = 0;
+    f->n = read(f->fd, f->buf, BUFSIZ);
+    if(f->n <= 0){
+      f->flags |= f->n == 0 ? F_EOF : F_ERR;
+      f->n = 0;
+      return EOF;
+    }
+  }
+  return f->buf[f->r++] & 0xff;
+}
+
+// Read a line, including its newline, of up to max-1 bytes.
+// Return 0 at end of file if nothing was read.
+char*
+fgets(char *buf, int max, FILE *f)
+{
+  int i, c;
+
+  for(i = 0; i+1 < max; ){
+    if((c = fgetc(f)) == EOF)
+      break;
+    buf[i++] = c;
+    if(c == '\n')
+      break;
+  }
+  buf[i] = '\0';
+  if(i == 0)
+    return 0;
+  return buf;
+}
+
+int
+feof(FILE *f)
+{
+  return (f->flags & F_EOF) != 0;
+}
+
+int
+ferror(FILE *f)
+{
+  return (f->flags & F_ERR) != 0;
+}
+
+// Set f's buffering mode. Call before any I/O on f.
+int
+setvbuf(FILE *f, int mode)
+{
+  if(mode != _IONBF && mode != _IOLBF && mode != _IOFBF)
+    return -1;
+  fflush(f);
+  f->mode = mode;
+  return 0;
+}
+
+// Make a FILE for fd; mode is "r" or "w".
+FILE*
+fdopen(int fd, const char *mode)
+{
+  FILE *f;
+
+  if(fd < 0 || (mode[0] != 'r' && mode[0] != 'w'))
+    return 0;
+  for(f = &files[3]; f < &files[NFILES]; f++){
+    if(f->fd < 0){
+      f->fd = fd;
+      f->flags = mode[0] == 'r' ? F_READ : F_WRITE;
+      f->mode = -1;
+      f->r = f->n = 0;
+      return f;
+    }
+  }
+  return 0;
+}
+
+// Open path for reading ("r") or for writing from
+// scratch ("w").
+FILE*
+fopen(const char *path, const char *mode)
+{
+  FILE *f;
+  int fd;
+
+  if(mode[0] == 'r')
+    fd = open(path, O_RDONLY);
+  else if(mode[0] == 'w')
+    fd = open(path, O_CREATE | O_TRUNC | O_WRONLY);
+  else
+    return 0;
+  if(fd < 0)
+    return 0;
+  if((f = fdopen(fd, mode)) == 0)
+    close(fd);
+  return f;
+}
+
+int
+fclose(FILE *f)
+{
+  int r;
+
+  r = fflush(f);
+  if(close(f->fd) < 0)
+    r = EOF;
+  f->fd = -1;
+  return r;
+}
+
+// The system calls that end or replace the program, or
+// copy it, flush buffered output first.
+
+int
+fork(void)
+{
+  fflush(0);
+  return _fork();
+}
+
+int
+exec(char *path, char **argv)
+{
+  fflush(0);
+  return _exec(path, argv);
+}
+
+int
+exit(int status)
+{
+  fflush(0);
+  _exit(status);
+}
@@ -52,6 +52,9 @@ strchr(const char *s, char c)
   return 0;
 }
 
+// Read a line from fd 0 a byte at a time, so that nothing
+// past the newline is consumed; sh relies on this to leave
+// the rest of its input to the commands it runs.
 char*
 gets(char *buf, int max)
 {
@@ -2,89 +2,227 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with segregated size classes.
+//
+// The heap is made of page-aligned runs of pages from sbrk().
+// Each run starts with a struct run, so free() finds the run
+// of any block malloc() returned by rounding its address down
+// to a page boundary.
+//
+// Requests of up to MAXSMALL bytes are rounded up to a power
+// of two, their size class, and served from a slab: a one-page
+// run cut into blocks of that size, with its own free list.
+// Each class keeps a list of its slabs that have free blocks,
+// so malloc() and free() of small blocks take constant time.
+// A slab whose blocks are all free goes back to the free runs,
+// unless it is the class's last one.
+//
+// Larger requests get a run of their own. Free runs are kept
+// sorted by address and coalesced, and once the one at the
+// program break grows past KEEP pages, the pages beyond that
+// are given back to the kernel with sbrk().
 
-typedef long Align;
+#define MINBLOCK 16     // smallest block size
+#define NCLASS   7      // block sizes 16, 32, ..., 1024
+#define MAXSMALL (MINBLOCK << (NCLASS-1))
+#define LARGE    (-1)   // cls of a large allocation
+#define FREE     (-2)   // cls of a free run
+#define KEEP     8      // free pages to keep at the break
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+struct block {
+  struct block *next;
 };
 
-typedef union header Header;
+struct run {
+  int cls;              // size class, LARGE or FREE
+  int npage;            // pages in the run
+  int nfree;            // free blocks in a slab
+  struct block *free;   // a slab's free blocks
+  struct run *next;     // in a class's slab list, or in freeruns
+  struct run *prev;
+};
 
-static Header base;
-static Header *freep;
+// blocks start this far into a run, so that every block is
+// aligned to its size, up to HDR.
+#define HDR 64
 
-void
-free(void *ap)
+static struct run *slabs[NCLASS];  // slabs with free blocks
+static struct run *freeruns;       // free runs, sorted by address
+
+static int
+nblocks(int cls)
+{
+  return (PGSIZE - HDR) / (MINBLOCK << cls);
+}
+
+static void
+rmlist(struct run **list, struct run *r)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    *list = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+}
+
+static void
+addlist(struct run **list, struct run *r)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  r->prev = 0;
+  r->next = *list;
+  if(*list)
+    (*list)->prev = r;
+  *list = r;
 }
 
-static Header*
-morecore(uint nu)
+// Give run r back to the free runs, merging it with its
+// neighbours, and return the pages at the program break
+// beyond KEEP to the kernel.
+static void
+freerun(struct run *r)
 {
+  struct run *p, *prev;
+
+  r->cls = FREE;
+  prev = 0;
+  for(p = freeruns; p && p < r; p = p->next)
+    prev = p;
+  r->prev = prev;
+  r->next = p;
+  if(prev)
+    prev->next = r;
+  else
+    freeruns = r;
+  if(p)
+    p->prev = r;
+
+  if(p && (char*)r + r->npage*PGSIZE == (char*)p){
+    r->npage += p->npage;
+    rmlist(&freeruns, p);
+  }
+  if(prev && (char*)prev + prev->npage*PGSIZE == (char*)r){
+    prev->npage += r->npage;
+    rmlist(&freeruns, r);
+    r = prev;
+  }
+
+  if(r->next == 0 && r->npage > KEEP &&
+     (char*)r + r->npage*PGSIZE == sbrk(0)){
+    sbrk(-(r->npage - KEEP)*PGSIZE);
+    r->npage = KEEP;
+  }
+}
+
+// Take a run of npage pages from the free runs (first fit),
+// or from the kernel.
+static struct run*
+allocrun(int npage)
+{
+  struct run *r, *rest;
   char *p;
-  Header *hp;
+  uint64 pad;
+
+  for(r = freeruns; r; r = r->next){
+    if(r->npage >= npage){
+      rmlist(&freeruns, r);
+      if(r->npage > npage){
+        rest = (struct run*)((char*)r + npage*PGSIZE);
+        rest->npage = r->npage - npage;
+        freerun(rest);
+        r->npage = npage;
+      }
+      return r;
+    }
+  }
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
+  // runs must be page-aligned, but the break need not be.
+  p = sbrk(0);
+  pad = PGROUNDUP((uint64)p) - (uint64)p;
+  if(npage > (0x7fffffff - pad) / PGSIZE)
+    return 0;
+  p = sbrk(pad + npage*PGSIZE);
   if(p == (char*)-1)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  r = (struct run*)(p + pad);
+  r->npage = npage;
+  return r;
+}
+
+// Make a new slab for class cls and add it to slabs[cls].
+static struct run*
+newslab(int cls)
+{
+  struct run *s;
+  struct block *b;
+  int i, n;
+
+  if((s = allocrun(1)) == 0)
+    return 0;
+  s->cls = cls;
+  n = nblocks(cls);
+  s->free = 0;
+  for(i = n-1; i >= 0; i--){
+    b = (struct block*)((char*)s + HDR + i*(MINBLOCK << cls));
+    b->next = s->free;
+    s->free = b;
+  }
+  s->nfree = n;
+  addlist(&slabs[cls], s);
+  return s;
+}
+
+void
+free(void *ap)
+{
+  struct run *r;
+  struct block *b;
+
+  if(ap == 0)
+    return;
+  r = (struct run*)PGROUNDDOWN((uint64)ap);
+  if(r->cls == LARGE){
+    freerun(r);
+    return;
+  }
+
+  b = ap;
+  b->next = r->free;
+  r->free = b;
+  r->nfree++;
+  if(r->nfree == 1)
+    addlist(&slabs[r->cls], r);
+  else if(r->nfree == nblocks(r->cls) && (r->prev || r->next)){
+    rmlist(&slabs[r->cls], r);
+    freerun(r);
+  }
 }
 
 void*
 malloc(uint nbytes)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct run *r;
+  struct block *b;
+  int cls;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
-    }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+  if(nbytes <= MAXSMALL){
+    for(cls = 0; (MINBLOCK << cls) < nbytes; cls++)
+      ;
+    if((r = slabs[cls]) == 0 && (r = newslab(cls)) == 0)
+      return 0;
+    b = r->free;
+    r->free = b->next;
+    if(--r->nfree == 0)
+      rmlist(&slabs[cls], r);
+    return b;
   }
+
+  if(nbytes > 0x7fffffff - HDR - PGSIZE)
+    return 0;
+  if((r = allocrun((nbytes + HDR + PGSIZE - 1) / PGSIZE)) == 0)
+    return 0;
+  r->cls = LARGE;
+  return (char*)r + HDR;
 }
@@ -1,16 +1,18 @@
 struct stat;
+struct iostat;
 struct rtcdate;
+typedef struct FILE FILE;
 
 // system calls
-int fork(void);
-int exit(int) __attribute__((noreturn));
+int _fork(void);
+int _exit(int) __attribute__((noreturn));
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
 int read(int, void*, int);
 int close(int);
 int kill(int);
-int exec(char*, char**);
+int _exec(char*, char**);
 int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
@@ -23,6 +25,13 @@ int getpid(void);
 char* sbrk(int);
 int sleep(int);
 int uptime(void);
+int lockstat(char*, uint64*);
+int fcntl(int, int, int);
+int syscount(void);
+int iostat(struct iostat*);
+int fsync(int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -30,8 +39,6 @@ char* strcpy(char*, const char*);
 void *memmove(void*, const void*, int);
 char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
-void fprintf(int, const char*, ...);
-void printf(const char*, ...);
 char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
@@ -40,3 +47,33 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+
+// printf.c
+void fprintf(FILE*, const char*, ...);
+void printf(const char*, ...);
+
+// stdio.c
+#define BUFSIZ 512
+#define EOF    (-1)
+#define _IONBF 0  // unbuffered: write at the end of each call
+#define _IOLBF 1  // line buffered
+#define _IOFBF 2  // fully buffered
+extern FILE *stdin, *stdout, *stderr;
+FILE* fopen(const char*, const char*);
+FILE* fdopen(int, const char*);
+int fclose(FILE*);
+int fflush(FILE*);
+int setvbuf(FILE*, int);
+int fputc(int, FILE*);
+int fputs(const char*, FILE*);
+int fwrite(const void*, int, FILE*);
+int fgetc(FILE*);
+char* fgets(char*, int, FILE*);
+int feof(FILE*);
+int ferror(FILE*);
+#define putc(c, f) fputc(c, f)
+#define getc(f)    fgetc(f)
+// these flush every FILE, then make the system call.
+int fork(void);
+int exit(int) __attribute__((noreturn));
+int exec(char*, char**);
@@ -569,9 +569,12 @@ writetest(char *s)
   }
 }
 
+// a file of several megabytes, most of it mapped
+// through the doubly-indirect block.
 void
 writebig(char *s)
 {
+  enum { NBLK = 6*1024 };
   int i, fd, n;
 
   fd = open("big", O_CREATE|O_RDWR);
@@ -580,7 +583,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBLK; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -600,7 +603,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBLK){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -623,6 +626,376 @@ writebig(char *s)
   }
 }
 
+// fsync() waits for a file's changes to commit, and
+// works on files and directories but not pipes.
+void
+fsynctest(char *s)
+{
+  int fd, fds[2];
+
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsyncf failed\n", s);
+    exit(1);
+  }
+  if(write(fd, "hello", 5) != 5 || fsync(fd) != 0){
+    printf("%s: write+fsync failed\n", s);
+    exit(1);
+  }
+  // nothing new to commit.
+  if(fsync(fd) != 0){
+    printf("%s: second fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open(".", O_RDONLY);
+  if(fd < 0 || fsync(fd) != 0){
+    printf("%s: fsync of . failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  if(fsync(fds[0]) != -1){
+    printf("%s: fsync of a closed fd succeeded\n", s);
+    exit(1);
+  }
+  unlink("fsyncf");
+}
+
+// rewrite the same few blocks, committing each time, so that
+// the log wraps around many times with the same blocks logged
+// in many slots, and check that the last writes win.
+void
+logwrap(char *s)
+{
+  enum { NF = 4, N = 300 };
+  static char buf[BSIZE];
+  char name[8];
+  int fd, i, j, f;
+
+  for(i = 0; i < N; i++){
+    f = i % NF;
+    name[0] = 'w';
+    name[1] = '0' + f;
+    name[2] = '\0';
+    fd = open(name, O_CREATE|O_WRONLY);
+    if(fd < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    memset(buf, i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf) || fsync(fd) != 0){
+      printf("%s: write+fsync failed\n", s);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  for(f = 0; f < NF; f++){
+    name[0] = 'w';
+    name[1] = '0' + f;
+    name[2] = '\0';
+    fd = open(name, O_RDONLY);
+    if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("%s: read %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    for(j = 0; j < sizeof(buf); j++){
+      if(buf[j] != (char)(N - NF + f)){
+        printf("%s: %s has stale contents\n", s, name);
+        exit(1);
+      }
+    }
+    unlink(name);
+  }
+}
+
+// grow the heap by a few superpages' worth, and check that
+// fork() copies it, that a child's writes to it stay in the
+// child, and that shrinking it into the middle of a
+// superpage keeps the memory below the new end.
+void
+superpage(char *s)
+{
+  enum { SZ = 3*SUPERPGSIZE };
+  char *p, *end, *a;
+  int pid, xstatus;
+
+  p = sbrk(SZ);
+  if(p == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  end = p + SZ;
+  for(a = p; a < end; a += PGSIZE)
+    *a = (uint64)a / PGSIZE;
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(a = p; a < end; a += PGSIZE){
+      if(*a != (char)((uint64)a / PGSIZE))
+        exit(1);
+      *a = 0;
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong memory\n", s);
+    exit(1);
+  }
+  for(a = p; a < end; a += PGSIZE){
+    if(*a != (char)((uint64)a / PGSIZE)){
+      printf("%s: child's write seen by parent\n", s);
+      exit(1);
+    }
+  }
+
+  a = (char*)SUPERPGROUNDUP((uint64)p) + SUPERPGSIZE/2;
+  if(sbrk(-(end - a)) == (char*)-1){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+  for(end = a, a = p; a < end; a += PGSIZE){
+    if(*a != (char)((uint64)a / PGSIZE)){
+      printf("%s: memory lost by shrink\n", s);
+      exit(1);
+    }
+  }
+  sbrk(-(end - p));
+}
+
+// use more memory than the machine has, so that the kernel
+// must swap some of it out, and check that every page comes
+// back with what was written to it.
+void
+swaptest(char *s)
+{
+  enum { SZ = 136*1024*1024 };
+  struct iostat st0, st1;
+  char *p, *end, *a;
+  int pid, xstatus;
+
+  iostat(&st0);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p = sbrk(SZ);
+    if(p == (char*)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    end = p + SZ;
+    for(a = p; a < end; a += PGSIZE){
+      *(uint64*)a = (uint64)a;
+      *(uint64*)(a + PGSIZE - 8) = ~(uint64)a;
+    }
+    for(a = p; a < end; a += PGSIZE){
+      if(*(uint64*)a != (uint64)a || *(uint64*)(a + PGSIZE - 8) != ~(uint64)a){
+        printf("%s: wrong contents at %p\n", s, a);
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  iostat(&st1);
+  if(st1.swapouts == st0.swapouts){
+    printf("%s: nothing was swapped out\n", s);
+    exit(1);
+  }
+}
+
+// mmap() a file privately and shared, read it through the
+// mapping, and check that only shared writes reach the file,
+// at munmap() or exit().
+void
+mmaptest(char *s)
+{
+  enum { SZ = 2*PGSIZE + PGSIZE/2 };
+  char *p, *q;
+  int fd, fd2, i, pid, xstatus;
+  static char buf[PGSIZE];
+
+  fd = open("mmapf", O_CREATE|O_TRUNC|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < SZ; i += sizeof(buf)){
+    memset(buf, 'a' + i/PGSIZE, sizeof(buf));
+    if(write(fd, buf, i + sizeof(buf) > SZ ? SZ - i : sizeof(buf)) < 0){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+
+  // private: reads see the file, beyond its end is zero,
+  // and writes stay in the process.
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 3*PGSIZE; i++){
+    if(p[i] != (i < SZ ? 'a' + i/PGSIZE : 0)){
+      printf("%s: wrong byte %d in private mapping\n", s, i);
+      exit(1);
+    }
+  }
+  p[0] = 'X';
+  if(munmap(p, 3*PGSIZE) != 0){
+    printf("%s: munmap private failed\n", s);
+    exit(1);
+  }
+
+  // read() into, and write() from, untouched mappings of the
+  // file being read and written: the faults happen while the
+  // file is in use, and mustn't wait for it.
+  fd2 = open("mmapf", O_RDWR);
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd2, 0);
+  q = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd2, 0);
+  if(fd2 < 0 || p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap for read and write failed\n", s);
+    exit(1);
+  }
+  if(read(fd2, p, PGSIZE) != PGSIZE || p[0] != 'a'){
+    printf("%s: read into mapping failed\n", s);
+    exit(1);
+  }
+  if(write(fd2, q, PGSIZE) != PGSIZE){
+    printf("%s: write from mapping failed\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  munmap(q, PGSIZE);
+  close(fd2);
+
+  // two shared mappings of a page are the same memory, and a
+  // write() to the page isn't undone when it is written back.
+  fd2 = open("mmapf", O_RDWR);
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd2, 0);
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd2, 0);
+  if(fd2 < 0 || p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap shared twice failed\n", s);
+    exit(1);
+  }
+  p[100] = 'M';
+  if(q[100] != 'M'){
+    printf("%s: shared mappings differ\n", s);
+    exit(1);
+  }
+  if(read(fd2, buf, 100) != 100 || write(fd2, "W", 1) != 1 || p[100] != 'W'){
+    printf("%s: write() not seen in mapping\n", s);
+    exit(1);
+  }
+  q[101] = 'N';
+  munmap(p, PGSIZE);
+  munmap(q, PGSIZE);
+  close(fd2);
+  fd2 = open("mmapf", O_RDONLY);
+  if(fd2 < 0 || read(fd2, buf, 102) != 102 || buf[100] != 'W' || buf[101] != 'N'){
+    printf("%s: shared page written back wrong\n", s);
+    exit(1);
+  }
+  close(fd2);
+
+  // shared, from the second page: a write in the middle,
+  // unmapped in two parts, and one in a child that exits.
+  p = mmap(0, 2*PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, PGSIZE);
+  if(p == (char*)-1){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[10] = 'Y';
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(p[10] != 'Y')
+      exit(1);
+    p[PGSIZE + 10] = 'Z';
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[PGSIZE + 10] != 'Z'){
+    printf("%s: child's shared write not seen\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) != 0 || munmap(p + PGSIZE, PGSIZE) != 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmapf", O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[0] != 'a'){
+    printf("%s: private write reached the file\n", s);
+    exit(1);
+  }
+  if(read(fd, buf, sizeof(buf)) != sizeof(buf) || buf[10] != 'Y'){
+    printf("%s: shared write lost\n", s);
+    exit(1);
+  }
+  if(read(fd, buf, sizeof(buf)) != PGSIZE/2 || buf[10] != 'Z'){
+    printf("%s: child's shared write lost, or file grew\n", s);
+    exit(1);
+  }
+
+  // a read-only file can't be mapped shared and writable,
+  // and an unmapped page can't be touched.
+  if(mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0) != (char*)-1){
+    printf("%s: writable mapping of read-only file\n", s);
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  q = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if(p == (char*)-1 || q == (char*)-1 || p == q){
+    printf("%s: second mapping failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(p[0] != 'a' || munmap(p, PGSIZE) != 0){
+    printf("%s: mapping outlived by its fd failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid == 0){
+    printf("%s: %d\n", s, p[0]);
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: read of unmapped page succeeded\n", s);
+    exit(1);
+  }
+  munmap(q, PGSIZE);
+  unlink("mmapf");
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -779,6 +1152,68 @@ pipe1(char *s)
   }
 }
 
+// a pipe's buffer grows up to the fcntl(F_SETPIPE_SZ) limit,
+// here while its oldest data starts in the middle of a page.
+void
+pipegrow(char *s)
+{
+  int fds[2], i, n, seq, rseq, total;
+  enum { N=64, SZ=1000, LIMIT=64*1024 };
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_GETPIPE_SZ, 0) <= 0 ||
+     fcntl(fds[1], F_SETPIPE_SZ, LIMIT) != LIMIT ||
+     fcntl(fds[0], F_GETPIPE_SZ, 0) != LIMIT){
+    printf("%s: fcntl F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 1024*1024) != -1){
+    printf("%s: fcntl accepted a huge pipe size\n", s);
+    exit(1);
+  }
+  if(fcntl(0, F_GETPIPE_SZ, 0) != -1){
+    printf("%s: fcntl F_GETPIPE_SZ on a non-pipe succeeded\n", s);
+    exit(1);
+  }
+
+  // a single process, so none of these writes may block.
+  seq = rseq = 0;
+  total = 0;
+  for(n = 0; n < N; n++){
+    for(i = 0; i < SZ; i++)
+      buf[i] = seq++;
+    if(write(fds[1], buf, SZ) != SZ){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+    if(n == 0){
+      if(read(fds[0], buf, 300) != 300){
+        printf("%s: read failed\n", s);
+        exit(1);
+      }
+      rseq = 300;
+      total = 300;
+    }
+  }
+  close(fds[1]);
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (rseq++ & 0xff)){
+        printf("%s: wrong data at byte %d\n", s, total + i);
+        exit(1);
+      }
+    }
+    total += n;
+  }
+  if(total != N * SZ){
+    printf("%s: read %d bytes, expected %d\n", s, total, N * SZ);
+    exit(1);
+  }
+  close(fds[0]);
+}
 
 // test if child is killed (status = -1)
 void
@@ -1553,6 +1988,163 @@ bigdir(char *s)
   }
 }
 
+// a directory large enough to be hashed: its entries can be
+// found, removed and read back as plain dirents, and it can
+// be removed once empty. the entries are all links to one
+// file, since inodes are few.
+void
+hashdir(char *s)
+{
+  enum { N = 300 };
+  int i, fd, n;
+  char name[16];
+  struct dirent de;
+
+  if(mkdir("hd") != 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  fd = open("hdfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create hdfile failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    name[0] = 'h'; name[1] = 'd'; name[2] = '/';
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    name[5] = '\0';
+    if(link("hdfile", name) != 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i += 2){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    fd = open(name, O_RDONLY);
+    if((fd >= 0) != (i % 2)){
+      printf("%s: open %s returned %d\n", s, name, fd);
+      exit(1);
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  if(open("hd/zz", O_RDONLY) >= 0 || chdir("hd/..") != 0){
+    printf("%s: hd lookup failed\n", s);
+    exit(1);
+  }
+
+  fd = open("hd", O_RDONLY);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != 2 + N/2){
+    printf("%s: read %d entries from hd, want %d\n", s, n, 2 + N/2);
+    exit(1);
+  }
+
+  if(unlink("hd") == 0){
+    printf("%s: unlink non-empty hd succeeded\n", s);
+    exit(1);
+  }
+  for(i = 1; i < N; i += 2){
+    name[3] = 'a' + i / 26;
+    name[4] = 'a' + i % 26;
+    if(unlink(name) != 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") != 0){
+    printf("%s: unlink empty hd failed\n", s);
+    exit(1);
+  }
+  unlink("hdfile");
+}
+
+// path lookups must see each link, unlink and mkdir at once,
+// including names that were looked up and not found before,
+// and a removed directory's names must not outlive it.
+void
+dcache(char *s)
+{
+  int fd;
+
+  if(mkdir("dc") != 0){
+    printf("%s: mkdir dc failed\n", s);
+    exit(1);
+  }
+  if(open("dc/f", O_RDONLY) >= 0){
+    printf("%s: open dc/f succeeded before create\n", s);
+    exit(1);
+  }
+  fd = open("dc/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create dc/f failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dc/f", O_RDONLY)) < 0){
+    printf("%s: open dc/f failed after create\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  if(open("dc/g", O_RDONLY) >= 0 || link("dc/f", "dc/g") != 0 ||
+     (fd = open("dc/g", O_RDONLY)) < 0){
+    printf("%s: open dc/g failed after link\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("dc/f") != 0 || open("dc/f", O_RDONLY) >= 0){
+    printf("%s: open dc/f succeeded after unlink\n", s);
+    exit(1);
+  }
+  if(unlink("dc/g") != 0){
+    printf("%s: unlink dc/g failed\n", s);
+    exit(1);
+  }
+
+  if(open("dc/d/.", O_RDONLY) >= 0 || mkdir("dc/d") != 0 ||
+     (fd = open("dc/d/.", O_RDONLY)) < 0){
+    printf("%s: open dc/d/. failed after mkdir\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("dc/d") != 0 || open("dc/d/.", O_RDONLY) >= 0){
+    printf("%s: open dc/d/. succeeded after unlink\n", s);
+    exit(1);
+  }
+
+  // a file likely reuses dc/d's inode.
+  fd = open("dc/d", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create dc/d failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(open("dc/d/.", O_RDONLY) >= 0 || open("dc/d/..", O_RDONLY) >= 0){
+    printf("%s: file dc/d has directory entries\n", s);
+    exit(1);
+  }
+  if(unlink("dc/d") != 0 || unlink("dc") != 0){
+    printf("%s: cleanup failed\n", s);
+    exit(1);
+  }
+}
+
 void
 subdir(char *s)
 {
@@ -1815,9 +2407,10 @@ manywrites(char *s)
 void
 bigfile(char *s)
 {
-  enum { N = 20, SZ=600 };
+  enum { N = 5000, SZ=600 };
   int fd, i, total, cc;
 
+  // about 3MB, in writes that straddle block boundaries.
   unlink("bigfile.dat");
   fd = open("bigfile.dat", O_CREATE | O_RDWR);
   if(fd < 0){
@@ -1851,7 +2444,7 @@ bigfile(char *s)
       printf("%s: short read bigfile\n", s);
       exit(1);
     }
-    if(buf[0] != i/2 || buf[SZ/2-1] != i/2){
+    if((buf[0] & 0xff) != (i/2 & 0xff) || (buf[SZ/2-1] & 0xff) != (i/2 & 0xff)){
       printf("%s: read bigfile wrong data\n", s);
       exit(1);
     }
@@ -2040,6 +2633,74 @@ iref(char *s)
   chdir("/");
 }
 
+// hold more distinct files open at once than NINODE.
+void
+manyinodes(char *s)
+{
+  enum { NCHILD = 5, NF = 12 };
+  int i, j, pid, fds[2], go[2], fd;
+  char name[8], c;
+
+  if(pipe(fds) != 0 || pipe(go) != 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(go[1]);
+      name[0] = 'm';
+      name[1] = 'i';
+      name[2] = '0' + i;
+      name[4] = '\0';
+      for(j = 0; j < NF; j++){
+        name[3] = 'a' + j;
+        if(open(name, O_CREATE|O_RDWR) < 0){
+          printf("%s: create %s failed\n", s, name);
+          write(fds[1], "f", 1);
+          exit(1);
+        }
+      }
+      write(fds[1], "x", 1);
+      read(go[0], &c, 1);
+      for(j = 0; j < NF; j++){
+        name[3] = 'a' + j;
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  close(go[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(fds[0], &c, 1) != 1 || c != 'x'){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  if(NCHILD*NF <= NINODE){
+    printf("%s: test opens too few files\n", s);
+    exit(1);
+  }
+  fd = open("README", O_RDONLY);
+  if(fd < 0){
+    printf("%s: open README failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(go[1]);
+  for(i = 0; i < NCHILD; i++){
+    wait(&j);
+    if(j != 0)
+      exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
 // test that fork fails gracefully
 // the forktest binary also does this, but it runs out of proc entries first.
 // inside the bigger usertests binary, we run out of memory first.
@@ -2080,6 +2741,70 @@ forktest(char *s)
   }
 }
 
+// copy-on-write fork: parent and child share pages until one
+// of them writes, and neither may see the other's writes,
+// including writes the kernel makes with copyout().
+void
+cowfork(char *s)
+{
+  enum { NPG = 8 };
+  char *a, c;
+  int i, pid, xstatus, fds[2], fds2[2];
+
+  a = sbrk(NPG*PGSIZE);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < NPG*PGSIZE; i++)
+    a[i] = 'p';
+  if(pipe(fds) != 0 || pipe(fds2) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    // write all but the last page, which stays shared.
+    for(i = 0; i < NPG*PGSIZE; i++){
+      if(a[i] != 'p'){
+        printf("%s: child sees wrong data\n", s);
+        exit(1);
+      }
+      if(i < (NPG-1)*PGSIZE)
+        a[i] = 'c';
+    }
+    if(write(fds[1], a, 10) != 10)
+      exit(1);
+    // stay alive until the parent has read.
+    read(fds2[0], &c, 1);
+    exit(0);
+  }
+
+  // read into the still-shared last page, so that
+  // the kernel's copyout() has to copy it first.
+  if(read(fds[0], a + (NPG-1)*PGSIZE, 10) != 10){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  write(fds2[1], "x", 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+
+  for(i = 0; i < NPG*PGSIZE; i++){
+    c = (i >= (NPG-1)*PGSIZE && i < (NPG-1)*PGSIZE + 10) ? 'c' : 'p';
+    if(a[i] != c){
+      printf("%s: parent sees wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2508,6 +3233,38 @@ stacktest(char *s)
     exit(xstatus);
 }
 
+// the kernel must not copy into or out of the page
+// beneath the user stack either.
+void
+stackcopy(char *s)
+{
+  char *guard = (char *) (PGROUNDDOWN(r_sp()) - PGSIZE);
+  int fd;
+
+  fd = open("stackcopy", O_CREATE|O_TRUNC|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  if(write(fd, guard, 1) != -1){
+    printf("%s: write() from below the stack worked\n", s);
+    exit(1);
+  }
+  write(fd, "x", 1);
+  close(fd);
+  fd = open("stackcopy", O_RDONLY);
+  if(fd < 0 || read(fd, guard, 1) != -1){
+    printf("%s: read() to below the stack worked\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(open(guard + PGSIZE - 1, O_RDONLY) != -1){
+    printf("%s: open() of a path below the stack worked\n", s);
+    exit(1);
+  }
+  unlink("stackcopy");
+}
+
 // regression test. copyin(), copyout(), and copyinstr() used to cast
 // the virtual page address to uint, which (with certain wild system
 // call arguments) resulted in a kernel page faults.
@@ -2617,6 +3374,79 @@ sbrk8000(char *s)
   *(top-1) = *(top-1) + 1;
 }
 
+// sbrk() allocates lazily: untouched pages read as zero, and
+// fork(), read(), write() and shrinking cope with the holes
+// between the pages that were touched.
+void
+sbrksparse(char *s)
+{
+  enum { BIG = 64*1024*1024, STRIDE = 1024*1024 };
+  char *a, *p, *hole;
+  int fd, pid, xstatus;
+
+  a = sbrk(BIG);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(p = a; p < a + BIG; p += STRIDE){
+    if(*p != 0){
+      printf("%s: new page not zero\n", s);
+      exit(1);
+    }
+    *p = 's';
+  }
+
+  // the child gets the same pages, and the same holes.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(p = a; p < a + BIG; p += STRIDE){
+      if(p[0] != 's' || p[PGSIZE] != 0)
+        exit(1);
+    }
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child saw wrong heap\n", s);
+    exit(1);
+  }
+
+  // write() from a hole writes zeros, and read() into
+  // a hole fills it in.
+  fd = open("sparse", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(write(fd, a, 1) != 1 || write(fd, a + STRIDE/2, 10) != 10){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("sparse", O_RDONLY);
+  hole = a + 3*STRIDE/2;
+  if(fd < 0 || read(fd, hole, 11) != 11){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("sparse");
+  if(hole[0] != 's' || hole[5] != 0 || hole[10] != 0){
+    printf("%s: read wrong data\n", s);
+    exit(1);
+  }
+
+  if(sbrk(-BIG) != a + BIG){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
 // regression test. does write() with an invalid buffer pointer cause
 // a block to be allocated for a file that is then not freed when the
 // file is deleted? if the kernel has this bug, it will panic: balloc:
@@ -2860,8 +3690,10 @@ main(int argc, char *argv[])
     {sbrkarg, "sbrkarg"},
     {sbrklast, "sbrklast"},
     {sbrk8000, "sbrk8000"},
+    {sbrksparse, "sbrksparse"},
     {validatetest, "validatetest"},
     {stacktest, "stacktest"},
+    {stackcopy, "stackcopy"},
     {opentest, "opentest"},
     {writetest, "writetest"},
     {writebig, "writebig"},
@@ -2871,6 +3703,7 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {pipegrow, "pipegrow"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
@@ -2880,7 +3713,16 @@ main(int argc, char *argv[])
     {dirfile, "dirfile"},
     {iref, "iref"},
     {forktest, "forktest"},
+    {cowfork, "cowfork"},
     {bigdir, "bigdir"}, // slow
+    {hashdir, "hashdir"},
+    {dcache, "dcache"},
+    {manyinodes, "manyinodes"},
+    {fsynctest, "fsync"},
+    {logwrap, "logwrap"},
+    {mmaptest, "mmap"},
+    {superpage, "superpage"},
+    {swaptest, "swap"},
     { 0, 0},
   };
 
@@ -2,30 +2,26 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 
-char buf[512];
-
 void
-wc(int fd, char *name)
+wc(FILE *f, char *name)
 {
-  int i, n;
+  int ch;
   int l, w, c, inword;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
+  while((ch = getc(f)) != EOF){
+    c++;
+    if(ch == '\n')
+      l++;
+    if(strchr(" \r\t\n\v", ch))
+      inword = 0;
+    else if(!inword){
+      w++;
+      inword = 1;
     }
   }
-  if(n < 0){
+  if(ferror(f)){
     printf("wc: read error\n");
     exit(1);
   }
@@ -35,20 +31,21 @@ wc(int fd, char *name)
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  FILE *f;
+  int i;
 
   if(argc <= 1){
-    wc(0, "");
+    wc(stdin, "");
     exit(0);
   }
 
   for(i = 1; i < argc; i++){
-    if((fd = open(argv[i], 0)) < 0){
+    if((f = fopen(argv[i], "r")) == 0){
       printf("wc: cannot open %s\n", argv[i]);
       exit(1);
     }
-    wc(fd, argv[i]);
-    close(fd);
+    wc(f, argv[i]);
+    fclose(f);
   }
   exit(0);
 }